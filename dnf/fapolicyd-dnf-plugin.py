@@ -32,5 +32,26 @@ class Fapolicyd(dnf.Plugin):
             sys.stderr.write("fapolicy-plugin does not have write permission: " + self.pipe + "\n")
             return
 
-        self.file.write("1")
+        self.file.write(self.describe_transaction())
         self.file.close()
+
+    def describe_transaction(self):
+        # Tell fapolicyd which packages were installed and which files were
+        # erased so it only has to look at those. A plain "1" makes it
+        # reload the whole rpm database.
+        try:
+            lines = []
+            for tsi in self.base.transaction:
+                pkg = tsi.pkg
+                if tsi.action in dnf.transaction.FORWARD_ACTIONS:
+                    lines.append("+%s-%s-%s.%s\n" % (pkg.name, pkg.version,
+                                                     pkg.release, pkg.arch))
+                elif tsi.action in dnf.transaction.BACKWARD_ACTIONS:
+                    lines.extend("-%s\n" % f for f in pkg.files)
+        except Exception:
+            return "1"
+
+        if not lines:
+            return "1"
+        lines.append(".\n")
+        return "".join(lines)
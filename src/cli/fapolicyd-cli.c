@@ -42,6 +42,7 @@
 #include "policy.h"
 #include "database.h"
 #include "file-cli.h"
+#include "trust-file.h"
 #include "fapolicyd-backend.h"
 #include "string-util.h"
 
@@ -52,6 +53,7 @@ static const char *usage =
 "-D, --dump-db         Dump the trust database contents\n"
 "-f, --file cmd path   Manage the file trust database\n"
 "--trust-file file     Use after --file to specify trust file\n"
+"--jobs N              Use after --file to hash with N threads\n"
 "-h, --help            Prints this help message\n"
 "-t, --ftype file-path Prints out the mime type of a file\n"
 "-l, --list            Prints a list of the daemon's rules with numbers\n"
@@ -213,13 +215,42 @@ env_close:
  * guarantee that argv[2] is the command because getopt_long would have
  * printed an error otherwise. argv[3] would be an optional parameter based
  * on which command is being run. If argv[4] == "--trust-file" then argv[5]
- * specifies a trust file to operate on.
+ * specifies a trust file to operate on. "--jobs N" may follow the path to
+ * set how many threads hash files.
  *
  * The function returns 0 on success and 1 on failure
  */
 static int do_manage_files(int argc, char * const argv[])
 {
 	int rc = 0;
+	char *args[4];
+	unsigned int jobs = 0;
+	int i, nargs = 0;
+
+	// Take out --jobs so the rest can be checked by position
+	for (i = 0; i < argc; i++) {
+		if (i >= 2 && strcmp(argv[i], "--jobs") == 0) {
+			char *end;
+
+			if (i + 1 >= argc)
+				goto args_err;
+			errno = 0;
+			jobs = strtoul(argv[i + 1], &end, 10);
+			if (errno || *end || jobs == 0 || jobs > 1024) {
+				fprintf(stderr, "Invalid number of jobs: %s\n",
+					argv[i + 1]);
+				return 1;
+			}
+			i++;
+			continue;
+		}
+		if (nargs == 4)
+			goto args_err;
+		args[nargs++] = argv[i];
+	}
+	argc = nargs;
+	argv = args;
+	trust_file_set_jobs(jobs, isatty(STDERR_FILENO));
 
 	if (argc > 0) {
 		if ( (strcmp("add", argv[0]) != 0)
@@ -475,7 +506,7 @@ int main(int argc, char * const argv[])
 		rc = do_dump_db();
 		break;
 	case 'f':
-		if (argc > 6)
+		if (argc > 8)
 			goto args_err;
 		// fapolicyd-cli, -f, | operation, path ...
 		// skip the first two args
@@ -32,6 +32,7 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "hash-cache.h"
 #include "llist.h"
 #include "message.h"
 #include "string-util.h"
@@ -108,7 +109,10 @@ int file_append(const char *path, const char *fname)
 	}
 
 	char *dest = fname ? fapolicyd_strcat(TRUST_DIR_PATH, fname) : TRUST_FILE_PATH;
+	hash_cache_load(HASH_CACHE_PATH);
 	int rc = trust_file_append(dest, &add_list);
+	hash_cache_save(HASH_CACHE_PATH);
+	hash_cache_destroy();
 
 	if (fname)
 		free(dest);
@@ -129,6 +133,13 @@ int file_delete(const char *path, const char *fname)
 		count = trust_file_delete_path_all(path);
 	}
 
+	if (count) {
+		hash_cache_load(HASH_CACHE_PATH);
+		hash_cache_forget(path);
+		hash_cache_save(HASH_CACHE_PATH);
+		hash_cache_destroy();
+	}
+
 	if (count == 0)
 		msg(LOG_ERR, "%s is not in the trust database", path);
 
@@ -140,6 +151,8 @@ int file_update(const char *path, const char *fname)
 	set_message_mode(MSG_STDERR, DBG_NO);
 	int count;
 
+	// Only files that changed since they were last hashed get hashed
+	hash_cache_load(HASH_CACHE_PATH);
 	if (fname) {
 		char *file = fapolicyd_strcat(TRUST_DIR_PATH, fname);
 		count = trust_file_update_path(file, path);
@@ -147,6 +160,8 @@ int file_update(const char *path, const char *fname)
 	} else {
 		count = trust_file_update_path_all(path);
 	}
+	hash_cache_save(HASH_CACHE_PATH);
+	hash_cache_destroy();
 
 	if (count == 0)
 		msg(LOG_ERR, "%s is not in the trust database", path);
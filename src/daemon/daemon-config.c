@@ -77,10 +77,18 @@ static int detailed_report_parser(const struct nv_pair *nv, int line,
 		conf_t *config);
 static int db_max_size_parser(const struct nv_pair *nv, int line,
 		conf_t *config);
+static int db_size_limit_parser(const struct nv_pair *nv, int line,
+		conf_t *config);
 static int subj_cache_size_parser(const struct nv_pair *nv, int line,
 		conf_t *config);
 static int obj_cache_size_parser(const struct nv_pair *nv, int line,
 		conf_t *config);
+static int cache_policy_parser(const struct nv_pair *nv, int line,
+		conf_t *config);
+static int cache_budget_parser(const struct nv_pair *nv, int line,
+		conf_t *config);
+static int cache_memory_limit_parser(const struct nv_pair *nv, int line,
+		conf_t *config);
 static int do_stat_report_parser(const struct nv_pair *nv, int line,
 		conf_t *config);
 static int watch_fs_parser(const struct nv_pair *nv, int line,
@@ -101,8 +109,12 @@ static const struct kw_pair keywords[] =
   {"gid",		gid_parser },
   {"detailed_report",	detailed_report_parser },
   {"db_max_size",	db_max_size_parser },
+  {"db_size_limit",	db_size_limit_parser },
   {"subj_cache_size",	subj_cache_size_parser },
   {"obj_cache_size",	obj_cache_size_parser },
+  {"cache_policy",	cache_policy_parser },
+  {"cache_budget",	cache_budget_parser },
+  {"cache_memory_limit", cache_memory_limit_parser },
   {"do_stat_report",	do_stat_report_parser },
   {"watch_fs",		watch_fs_parser },
   {"trust",		trust_parser },
@@ -124,8 +136,12 @@ static void clear_daemon_config(conf_t *config)
 	config->do_stat_report = 1;
 	config->detailed_report = 1;
 	config->db_max_size = 100;
+	config->db_size_limit = 0;
 	config->subj_cache_size = 1024;
 	config->obj_cache_size = 4096;
+	config->cache_policy = POLICY_2Q;
+	config->cache_budget = 0;
+	config->cache_memory_limit = 0;
 	config->watch_fs = strdup("ext4,xfs,tmpfs");
 #ifdef USE_RPM
 	config->trust = strdup("rpmdb,file");
@@ -476,6 +492,12 @@ static int db_max_size_parser(const struct nv_pair *nv, int line,
 	return unsigned_int_parser(&(config->db_max_size), nv->value, line);
 }
 
+static int db_size_limit_parser(const struct nv_pair *nv, int line,
+		conf_t *config)
+{
+	return unsigned_int_parser(&(config->db_size_limit), nv->value, line);
+}
+
 static int subj_cache_size_parser(const struct nv_pair *nv, int line,
 		conf_t *config)
 {
@@ -498,6 +520,40 @@ static int obj_cache_size_parser(const struct nv_pair *nv, int line,
 	return rc;
 }
 
+static const struct nv_list cache_policies[] =
+{
+  {"lru",   POLICY_LRU   },
+  {"clock", POLICY_CLOCK },
+  {"2q",    POLICY_2Q    },
+  { NULL,  0 }
+};
+
+static int cache_policy_parser(const struct nv_pair *nv, int line,
+		conf_t *config)
+{
+	for (int i=0; cache_policies[i].name != NULL; i++) {
+		if (strcasecmp(nv->value, cache_policies[i].name) == 0) {
+			config->cache_policy = cache_policies[i].option;
+			return 0;
+		}
+	}
+	msg(LOG_ERR, "Option %s not found - line %d", nv->value, line);
+	return 1;
+}
+
+static int cache_budget_parser(const struct nv_pair *nv, int line,
+		conf_t *config)
+{
+	return unsigned_int_parser(&(config->cache_budget), nv->value, line);
+}
+
+static int cache_memory_limit_parser(const struct nv_pair *nv, int line,
+		conf_t *config)
+{
+	return unsigned_int_parser(&(config->cache_memory_limit), nv->value,
+				   line);
+}
+
 static int do_stat_report_parser(const struct nv_pair *nv, int line,
 		conf_t *config)
 {
@@ -79,6 +79,33 @@ static struct fs_avl filesystems;
 static void usage(void) NORETURN;
 
 
+/*
+ * Ask the kernel to wake us when tasks stall on memory for 200ms within
+ * 2 seconds. Windows that are a multiple of 2 seconds work without
+ * privileges too. Kernels without PSI simply don't report pressure.
+ */
+#define PRESSURE_FILE "/proc/pressure/memory"
+#define PRESSURE_TRIGGER "some 200000 2000000"
+static int init_pressure_monitor(void)
+{
+	int fd = open(PRESSURE_FILE, O_RDWR|O_NONBLOCK|O_CLOEXEC);
+
+	if (fd < 0) {
+		msg(LOG_DEBUG, "Memory pressure is not monitored (%s)",
+		    strerror(errno));
+		return -1;
+	}
+	if (write(fd, PRESSURE_TRIGGER, strlen(PRESSURE_TRIGGER) + 1) < 0) {
+		msg(LOG_DEBUG, "Cannot set memory pressure trigger (%s)",
+		    strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+
 static void install_syscall_filter(void)
 {
 	scmp_filter_ctx ctx;
@@ -362,10 +389,10 @@ static void usage(void)
 
 int main(int argc, const char *argv[])
 {
-	struct pollfd pfd[2];
+	struct pollfd pfd[3];
 	struct sigaction sa;
 	struct rlimit limit;
-	int rc, i;
+	int rc, i, timeout = -1;
 
 	if (argc > 1 && strcmp(argv[1], "--help") == 0)
 		usage();
@@ -463,6 +490,10 @@ int main(int argc, const char *argv[])
 	// Write the pid file for the init system
 	write_pid_file();
 
+	// The trigger is set up while we can still write to /proc
+	pfd[2].fd = init_pressure_monitor();
+	pfd[2].events = POLLPRI;
+
 	// If we are not going to be root, then setup necessary capabilities
 	if (config.uid != 0) {
 		capng_clear(CAPNG_SELECT_BOTH);
@@ -495,6 +526,9 @@ int main(int argc, const char *argv[])
 	// Init the file test libraries
 	file_init();
 
+	// Start with the objects that were in use at the last shutdown
+	load_object_snapshot(OBJ_SNAPSHOT_PATH);
+
 	// Initialize the file watch system
 	pfd[0].fd = open("/proc/mounts", O_RDONLY);
 	pfd[0].events = POLLPRI;
@@ -504,7 +538,8 @@ int main(int argc, const char *argv[])
 
 	msg(LOG_INFO, "Starting to listen for events");
 	while (!stop) {
-		rc = poll(pfd, 2, -1);
+		// While the caches are shrunk, wake up to grow them back
+		rc = poll(pfd, 3, timeout);
 
 #ifdef DEBUG
 		msg(LOG_DEBUG, "Main poll interrupted");
@@ -525,6 +560,10 @@ int main(int argc, const char *argv[])
 				msg(LOG_DEBUG, "Mount change detected");
 				handle_mounts(pfd[0].fd);
 			}
+			if (pfd[2].revents & POLLPRI) {
+				relieve_memory_pressure();
+				timeout = 0;
+			}
 
 			// This will always need to be here as long as we
 			// link against librpm. Turns out that librpm masks
@@ -536,10 +575,14 @@ int main(int argc, const char *argv[])
 			sigaction(SIGINT, &sa, NULL);
 #endif
 		}
+		if (timeout >= 0)
+			timeout = recover_from_pressure();
 	}
 	msg(LOG_INFO, "shutting down...");
 	shutdown_fanotify(m);
 	close(pfd[0].fd);
+	if (pfd[2].fd >= 0)
+		close(pfd[2].fd);
 	mlist_clear(m);
 	free(m);
 	file_close();
@@ -563,6 +606,7 @@ int main(int argc, const char *argv[])
 			fclose(f);
 		}
 	}
+	save_object_snapshot(OBJ_SNAPSHOT_PATH);
 	destroy_event_system();
 	destroy_config();
 	destroy_fs_list();
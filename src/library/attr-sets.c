@@ -23,11 +23,13 @@
  *    Radovan Sroka <rsroka@redhat.com>
  */
 
+#include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "attr-sets.h"
+#include "intern.h"
 #include "message.h"
 
 #define RESIZE_BY 2
@@ -37,6 +39,8 @@ attr_sets_t sets;
 
 /*
  * this is a compare callback for avl string tree
+ * the strings are interned, so equal strings have the same address
+ * and the tree is ordered by address
  *
  * avl tree compare expect:
  * 0 when equals
@@ -45,7 +49,10 @@ attr_sets_t sets;
  */
 static int strcmp_cb(void * a, void * b)
 {
-	return strcmp(((avl_str_data_t *)a)->str, ((avl_str_data_t *)b)->str);
+	const char *sa = ((avl_str_data_t *)a)->str;
+	const char *sb = ((avl_str_data_t *)b)->str;
+
+	return (sa > sb) - (sa < sb);
 }
 
 /*
@@ -181,6 +188,25 @@ attr_sets_entry_t *init_standalone_set(const int type)
 	return s;
 }
 
+// Bytes of memory taken by a standalone set and its members
+size_t attr_set_bytes(attr_sets_entry_t *set)
+{
+	avl_iterator i;
+	avl *a;
+	size_t bytes;
+
+	if (set == NULL)
+		return 0;
+
+	bytes = malloc_usable_size(set);
+	for (a = avl_first(&i, &set->tree); a; a = avl_next(&i)) {
+		bytes += malloc_usable_size(a);
+		if (set->type == STRING)
+			bytes += intern_share(((avl_str_data_t *)a)->str);
+	}
+	return bytes;
+}
+
 int append_int_attr_set(attr_sets_entry_t * set, const int num)
 {
 	if (!set) return 1;
@@ -219,7 +245,7 @@ int append_str_attr_set(attr_sets_entry_t * set, const char * str)
 	if (!data)
 		return 1;
 
-	data->str = strdup(str);
+	data->str = intern(str);
 	if (!data->str) {
 		free(data);
 		return 1;
@@ -230,7 +256,7 @@ int append_str_attr_set(attr_sets_entry_t * set, const char * str)
 	avl * ret = avl_insert(&set->tree, (avl *)data);
 	if (ret != (avl *)data) {
 		// Already present in avl tree
-		free((void *)data->str);
+		intern_release(data->str);
 		free(data);
 		return 1;
 	}
@@ -260,6 +286,17 @@ int check_int_attr_set(attr_sets_entry_t * set, const int num)
 
 
 int check_str_attr_set(attr_sets_entry_t * set, const char * str)
+{
+	// if nobody uses the string, it can't be in the set
+	str = intern_find(str);
+	if (!str)
+		return 0;
+
+	return check_istr_attr_set(set, str);
+}
+
+// str has to be interned, the lookup only compares pointers
+int check_istr_attr_set(attr_sets_entry_t * set, const char * str)
 {
 	avl_str_data_t data;
 
@@ -357,7 +394,7 @@ void destroy_attr_set(attr_sets_entry_t * set)
 		if ((avl *)tmp != cur)
 			msg(LOG_DEBUG, "attr_set_entry: removal of invalid node");
 		if (set->type == STRING) {
-			free((void *)((avl_str_data_t *)tmp)->str);
+			intern_release(((avl_str_data_t *)tmp)->str);
 		}
 		free(tmp);
 	}
@@ -71,12 +71,14 @@ void destroy_attr_set(attr_sets_entry_t *set);
 void destroy_attr_sets(void);
 size_t search_attr_set_by_name(const char * name);
 attr_sets_entry_t *init_standalone_set(const int type);
+size_t attr_set_bytes(attr_sets_entry_t *set);
 
 int append_int_attr_set(attr_sets_entry_t * set, const int num);
 int append_str_attr_set(attr_sets_entry_t * set, const char * str);
 
 int check_int_attr_set(attr_sets_entry_t * set, const int num);
 int check_str_attr_set(attr_sets_entry_t * set, const char * str);
+int check_istr_attr_set(attr_sets_entry_t * set, const char * str);
 int check_pstr_attr_set(attr_sets_entry_t * set, const char * str);
 
 void print_attr_sets(void);
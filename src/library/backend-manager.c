@@ -25,9 +25,14 @@
 #include "config.h"
 #include <ctype.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include "conf.h"
 #include "message.h"
 #include "backend-manager.h"
@@ -138,14 +143,60 @@ int backend_init(const conf_t *conf)
 }
 
 
+static void *backend_load_thread(void *arg)
+{
+	backend *b = arg;
+
+	return (void *)(long)b->load();
+}
+
+
+/*
+ * Backends fill in their own lists and share nothing, so each one is
+ * loaded on its own thread. The lists are consumed in the configured
+ * order afterwards, so the result doesn't depend on which finishes first.
+ */
 int backend_load(void)
 {
-	for (backend_entry *be = backend_get_first();
-			be != NULL; be = be->next) {
-		if (be->backend->load())
-			return 1;
+	struct loader {
+		pthread_t thread;
+		int started;
+	} *loaders;
+	backend_entry *be;
+	long i, count = 0;
+	int rc = 0;
+
+	for (be = backend_get_first(); be != NULL; be = be->next)
+		count++;
+	if (count == 0)
+		return 0;
+
+	loaders = calloc(count, sizeof(struct loader));
+	if (loaders == NULL)
+		return 1;
+
+	// The first backend is loaded by this thread
+	for (i = 1, be = backend_get_first()->next; be != NULL;
+						be = be->next, i++)
+		loaders[i].started = !pthread_create(&loaders[i].thread,
+					NULL, backend_load_thread, be->backend);
+
+	for (i = 0, be = backend_get_first(); be != NULL; be = be->next, i++) {
+		void *res;
+
+		if (loaders[i].started)
+			pthread_join(loaders[i].thread, &res);
+		else
+			res = backend_load_thread(be->backend);
+		if (res) {
+			msg(LOG_ERR, "Failed to load %s backend",
+			    be->backend->name);
+			rc = 1;
+		}
 	}
-	return 0;
+	free(loaders);
+
+	return rc;
 }
 
 void backend_close(void)
@@ -162,3 +213,106 @@ backend_entry* backend_get_first(void)
 	return backends;
 }
 
+
+static unsigned long long fnv1a(unsigned long long h, const void *data,
+	size_t len)
+{
+	const unsigned char *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	return h;
+}
+
+
+/*
+ * Add a file's identity and change times to the stamp. Missing files
+ * count too, so creating one changes the stamp. Each file is hashed on
+ * its own and summed so the order files are visited in doesn't matter.
+ */
+void stamp_path(backend_stamp *st, const char *path)
+{
+	struct stat sb;
+	unsigned long long h = 0xcbf29ce484222325ULL;
+
+	h = fnv1a(h, path, strlen(path));
+	if (stat(path, &sb) == 0) {
+		h = fnv1a(h, &sb.st_dev, sizeof(sb.st_dev));
+		h = fnv1a(h, &sb.st_ino, sizeof(sb.st_ino));
+		h = fnv1a(h, &sb.st_size, sizeof(sb.st_size));
+		h = fnv1a(h, &sb.st_mtim, sizeof(sb.st_mtim));
+		h = fnv1a(h, &sb.st_ctim, sizeof(sb.st_ctim));
+	} else
+		h = fnv1a(h, &errno, sizeof(errno));
+	st->digest += h;
+	st->files++;
+}
+
+
+// Stamp a directory and everything below it
+void stamp_dir(backend_stamp *st, const char *path)
+{
+	DIR *d;
+	struct dirent *e;
+	char buf[4096];
+	size_t len = strlen(path);
+	const char *sep = (len && path[len-1] == '/') ? "" : "/";
+
+	stamp_path(st, path);
+	d = opendir(path);
+	if (d == NULL)
+		return;
+
+	while ((e = readdir(d))) {
+		if (strcmp(e->d_name, ".") == 0 ||
+		    strcmp(e->d_name, "..") == 0)
+			continue;
+		if (snprintf(buf, sizeof(buf), "%s%s%s", path, sep,
+			     e->d_name) >= (int)sizeof(buf))
+			continue;
+		if (e->d_type == DT_DIR)
+			stamp_dir(st, buf);
+		else if (e->d_type == DT_UNKNOWN) {
+			struct stat sb;
+
+			// Some file systems don't fill in d_type
+			if (lstat(buf, &sb) == 0 && S_ISDIR(sb.st_mode))
+				stamp_dir(st, buf);
+			else
+				stamp_path(st, buf);
+		} else
+			stamp_path(st, buf);
+	}
+	closedir(d);
+}
+
+
+/*
+ * This function writes one "name stamp" line for every configured
+ * backend into buf. It returns 0 on success and 1 if any backend cannot
+ * be stamped, in which case the backends have to be loaded to find out
+ * if they changed.
+ */
+int backend_stamps(char *buf, size_t size)
+{
+	size_t len = 0;
+
+	for (backend_entry *be = backend_get_first();
+			be != NULL; be = be->next) {
+		backend_stamp st = { 0, 0 };
+		int rc;
+
+		if (be->backend->stamp == NULL || be->backend->stamp(&st))
+			return 1;
+
+		rc = snprintf(buf + len, size - len, "%s %016llx %lu\n",
+			      be->backend->name, st.digest, st.files);
+		if (rc < 0 || (size_t)rc >= size - len)
+			return 1;
+		len += rc;
+	}
+	return 0;
+}
+
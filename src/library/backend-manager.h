@@ -40,6 +40,7 @@ int backend_init(const conf_t *conf);
 int backend_load(void);
 void backend_close(void);
 backend_entry* backend_get_first(void);
+int backend_stamps(char *buf, size_t size);
 
 #endif
 
@@ -0,0 +1,173 @@
+/*
+ * bloom.c - Bloom filter for quick negative answers
+ * Copyright (c) 2020 Red Hat Inc., Durham, North Carolina.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "bloom.h"
+
+/*
+ * About 10 bits per key with 7 probes gives a false positive rate near
+ * 1%. The bit count is rounded up to a power of 2 so it's usually better.
+ */
+#define BITS_PER_KEY	10
+#define NUM_PROBES	7
+#define MIN_BITS	(1UL << 16)
+
+
+void bloom_init(bloom_t *b)
+{
+	b->bits = NULL;
+	b->mask = 0;
+	b->capacity = 0;
+	b->items = 0;
+}
+
+
+/*
+ * Allocate a filter big enough for capacity keys. Any previous filter is
+ * released. It returns 0 on success and 1 on failure. A failed filter is
+ * empty which makes bloom_check answer maybe for everything.
+ */
+int bloom_create(bloom_t *b, unsigned long capacity)
+{
+	size_t nbits = MIN_BITS;
+
+	bloom_destroy(b);
+	while (nbits < capacity * BITS_PER_KEY)
+		nbits <<= 1;
+
+	b->bits = calloc(nbits / 8, 1);
+	if (b->bits == NULL)
+		return 1;
+	b->mask = nbits - 1;
+	b->capacity = capacity;
+	return 0;
+}
+
+
+void bloom_reset(bloom_t *b)
+{
+	if (b->bits)
+		memset(b->bits, 0, bloom_size(b));
+	b->items = 0;
+}
+
+
+void bloom_destroy(bloom_t *b)
+{
+	free(b->bits);
+	bloom_init(b);
+}
+
+
+/*
+ * FNV-1a followed by the splitmix64 finalizer. The two halves of the
+ * result seed the double hashing used to pick the probe positions.
+ */
+static uint64_t bloom_hash(const void *key, size_t len)
+{
+	const unsigned char *p = key;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 0x100000001b3ULL;
+	}
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h;
+}
+
+
+void bloom_add(bloom_t *b, const void *key, size_t len)
+{
+	uint64_t h, h1, h2;
+	unsigned int i;
+
+	if (b->bits == NULL)
+		return;
+
+	h = bloom_hash(key, len);
+	h1 = h & 0xFFFFFFFF;
+	h2 = (h >> 32) | 1;
+	for (i = 0; i < NUM_PROBES; i++) {
+		size_t bit = (h1 + i * h2) & b->mask;
+		b->bits[bit >> 3] |= 1 << (bit & 7);
+	}
+	b->items++;
+}
+
+
+/*
+ * Returns 0 if the key was definitely never added and 1 if it might
+ * have been.
+ */
+int bloom_check(const bloom_t *b, const void *key, size_t len)
+{
+	uint64_t h, h1, h2;
+	unsigned int i;
+
+	if (b->bits == NULL)
+		return 1;
+
+	h = bloom_hash(key, len);
+	h1 = h & 0xFFFFFFFF;
+	h2 = (h >> 32) | 1;
+	for (i = 0; i < NUM_PROBES; i++) {
+		size_t bit = (h1 + i * h2) & b->mask;
+		if ((b->bits[bit >> 3] & (1 << (bit & 7))) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+
+// Size of the bit array in bytes
+size_t bloom_size(const bloom_t *b)
+{
+	return b->bits ? (b->mask + 1) / 8 : 0;
+}
+
+
+/*
+ * Expected false positive rate. It is the chance that all probes land on
+ * set bits, so it's computed from the fraction of bits that are set.
+ */
+double bloom_fp_rate(const bloom_t *b)
+{
+	size_t i, size = bloom_size(b);
+	unsigned long set = 0;
+	double fill, rate = 1.0;
+
+	if (size == 0)
+		return 1.0;
+	for (i = 0; i < size; i++)
+		set += __builtin_popcount(b->bits[i]);
+	fill = (double)set / (double)(size * 8);
+	for (i = 0; i < NUM_PROBES; i++)
+		rate *= fill;
+	return rate;
+}
@@ -0,0 +1,43 @@
+/*
+ * bloom.h - Header file for bloom filter
+ * Copyright (c) 2020 Red Hat Inc., Durham, North Carolina.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+
+typedef struct bloom {
+	unsigned char *bits;
+	size_t mask;		// number of bits - 1, always a power of 2
+	unsigned long capacity;	// keys it was sized for
+	unsigned long items;	// keys added since the last reset
+} bloom_t;
+
+void bloom_init(bloom_t *b);
+int bloom_create(bloom_t *b, unsigned long capacity);
+void bloom_reset(bloom_t *b);
+void bloom_destroy(bloom_t *b);
+void bloom_add(bloom_t *b, const void *key, size_t len);
+int bloom_check(const bloom_t *b, const void *key, size_t len);
+size_t bloom_size(const bloom_t *b);
+double bloom_fp_rate(const bloom_t *b);
+
+#endif
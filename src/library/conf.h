@@ -25,6 +25,7 @@
 #define CONF_H
 
 #include <pwd.h>
+#include "lru.h"
 
 typedef enum { IN_NONE, IN_SIZE, IN_IMA, IN_SHA256 } integrity_t;
 
@@ -38,8 +39,12 @@ typedef struct conf
 	unsigned int do_stat_report;
 	unsigned int detailed_report;
 	unsigned int db_max_size;
+	unsigned int db_size_limit;
 	unsigned int subj_cache_size;
 	unsigned int obj_cache_size;
+	cache_policy_t cache_policy;
+	unsigned int cache_budget;
+	unsigned int cache_memory_limit;
 	const char *watch_fs;
 	const char *trust;
 	integrity_t integrity;
@@ -37,32 +37,47 @@
 #include <fcntl.h>
 #include <gcrypt.h>
 #include <signal.h>
+#include <time.h>
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include "database.h"
+#include "event.h"
 #include "message.h"
 #include "llist.h"
 #include "file.h"
+#include "bloom.h"
 
 #include "fapolicyd-backend.h"
 #include "backend-manager.h"
 #include "gcc-attributes.h"
+#include "path-set.h"
 
 
 // Local defines
-enum { READ_DATA, READ_TEST_KEY, READ_DATA_DUP };
+enum { READ_DATA, READ_DATA_DUP, READ_DATA_FILTERED };
 #define BUFFER_SIZE 4096
 #define MEGABYTE	(1024*1024)
+#define SHA512_LEN	64
+// Hashed keys keep the terminating NUL to stay compatible with older dbs
+#define HASH_KEY_SIZE	(SHA512_LEN * 2 + 1)
+// Room for a path with the /usr prefix added or its hashed key
+#define KEY_BUF_SIZE	(PATH_MAX + 5)
+#define MAX_DUPS	128
+// Room for the longest record DATA_FORMAT can make
+#define RECORD_SIZE	128
+#define LOOKUP_TXN_MAX_AGE 5	// seconds
 
 // Local variables
 static MDB_env *env;
 static MDB_dbi dbi;
+static size_t map_limit;	// 0 means the map may grow without limit
 static int dbi_init = 0;
 static unsigned MDB_maxkeysize;
 static const char *data_dir = DB_DIR;
 static const char *db = DB_NAME;
-static int lib_symlink=0, lib64_symlink=0, bin_symlink=0, sbin_symlink=0;
+static unsigned int usr_aliases = 0;
 static struct pollfd ffd[1] =  { {0, 0, 0} };
 static const char *fifo_path = "/run/fapolicyd/fapolicyd.fifo";
 static integrity_t integrity;
@@ -70,10 +85,18 @@ static integrity_t integrity;
 static pthread_t update_thread;
 static pthread_mutex_t update_lock;
 
+// Bumped whenever a write is committed. Protected by update_lock.
+static unsigned long db_generation = 0;
+
 // Local functions
 static void *update_thread_main(void *arg);
 static int update_database(conf_t *config);
 
+// Startup timing. Protected by update_lock once the update thread runs.
+static struct timespec startup_time;
+static double first_decision_time = -1.0, verified_time = -1.0;
+static int verify_pending = 0;
+
 // External variables
 extern volatile atomic_bool stop;
 extern volatile atomic_bool needs_flush;
@@ -92,6 +115,79 @@ static int is_link(const char *path)
 	return 0;
 }
 
+/*
+ * On merged /usr systems these top level directories are symlinks into
+ * /usr. A package may list a file under either name while fanotify always
+ * reports the resolved one. Whenever the alias is active on this system,
+ * the path is rewritten to its /usr name for both storing and lookup so
+ * that a single probe finds it.
+ */
+static const struct {
+	const char *dir;	// top level directory with trailing slash
+	size_t len;
+	unsigned int alias;
+} usr_alias_rules[] = {
+	{ "/lib64/", 7, USR_ALIAS_LIB64 },
+	{ "/lib/",   5, USR_ALIAS_LIB },
+	{ "/bin/",   5, USR_ALIAS_BIN },
+	{ "/sbin/",  6, USR_ALIAS_SBIN },
+};
+#define USR_ALIAS_RULES (sizeof(usr_alias_rules)/sizeof(usr_alias_rules[0]))
+
+
+/*
+ * This function applies the aliases to path. If the path needs
+ * rewriting, its canonical form is written to buf and its length is
+ * returned. It returns 0 if path is already canonical or if the rewritten
+ * path would not fit into size bytes.
+ */
+size_t canonical_trust_path(const char *path, unsigned int aliases,
+	char *buf, size_t size)
+{
+	unsigned int i;
+
+	// Paths under /usr are the common case and are already canonical
+	if (aliases == 0 || path[0] != '/' || path[1] == 'u')
+		return 0;
+
+	for (i = 0; i < USR_ALIAS_RULES; i++) {
+		if ((aliases & usr_alias_rules[i].alias) &&
+		    strncmp(path, usr_alias_rules[i].dir,
+			    usr_alias_rules[i].len) == 0) {
+			size_t len = strlen(path);
+
+			if (len + 5 > size)
+				return 0;
+			memcpy(buf, "/usr", 4);
+			memcpy(buf + 4, path, len + 1);
+			return len + 4;
+		}
+	}
+
+	return 0;
+}
+
+
+// Return the path that the trust database knows path by
+const char *trust_db_path(const char *path, char *buf, size_t size)
+{
+	if (canonical_trust_path(path, usr_aliases, buf, size))
+		return buf;
+	return path;
+}
+
+
+// Seconds from start until now
+static double elapsed_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
+
 const char *lookup_tsource(unsigned int tsource)
 {
 	switch (tsource)
@@ -142,9 +238,11 @@ int preconstruct_fifo(const conf_t *config)
 }
 
 
+static int open_dbi(MDB_txn *txn);
 static int init_db(const conf_t *config)
 {
-	unsigned int flags = MDB_MAPASYNC|MDB_NOSYNC;
+	MDB_txn *txn;
+	unsigned int flags = MDB_MAPASYNC|MDB_NOSYNC|MDB_NOTLS;
 #ifndef DEBUG
 	flags |= MDB_WRITEMAP;
 #endif
@@ -156,6 +254,7 @@ static int init_db(const conf_t *config)
 
 	if (mdb_env_set_mapsize(env, config->db_max_size*MEGABYTE))
 		return 3;
+	map_limit = (size_t)config->db_size_limit * MEGABYTE;
 
 	if (mdb_env_set_maxreaders(env, 4))
 		return 4;
@@ -166,43 +265,102 @@ static int init_db(const conf_t *config)
 		return 5;
 	}
 
+	// Open the dbi in a committed txn so that the handle belongs to the
+	// environment. The persistent lookup txn relies on it surviving resets.
+	if (mdb_txn_begin(env, NULL, 0, &txn))
+		return 6;
+	if (open_dbi(txn)) {
+		mdb_txn_abort(txn);
+		return 6;
+	}
+	if ((rc = mdb_txn_commit(txn))) {
+		msg(LOG_ERR, "dbi commit error: %s", mdb_strerror(rc));
+		return 6;
+	}
+
 	MDB_maxkeysize = mdb_env_get_maxkeysize(env);
 	integrity = config->integrity;
 	msg(LOG_INFO, "fapolicyd integrity is %u", integrity);
 
-	lib_symlink = is_link("/lib");
-	lib64_symlink = is_link("/lib64");
-	bin_symlink = is_link("/bin");
-	sbin_symlink = is_link("/sbin");
+	if (is_link("/lib"))
+		usr_aliases |= USR_ALIAS_LIB;
+	if (is_link("/lib64"))
+		usr_aliases |= USR_ALIAS_LIB64;
+	if (is_link("/bin"))
+		usr_aliases |= USR_ALIAS_BIN;
+	if (is_link("/sbin"))
+		usr_aliases |= USR_ALIAS_SBIN;
 
 	return 0;
 }
 
 
 static unsigned get_pages_in_use(void);
-static unsigned long pages, max_pages;
-static void close_db(void)
+static void close_lookup_txn(void);
+static unsigned long pages, max_pages, map_grows;
+static unsigned long lookups, lookup_renewals;
+static unsigned long long lookup_ns_total, lookup_ns_max;
+
+// Filter of every key in the database. Protected by update_lock.
+static bloom_t trust_filter;
+static unsigned long filter_rejects, filter_false_pos;
+static unsigned long filter_size, filter_items;
+static double filter_fp_rate;
+static size_t map_size;
+static void update_page_stats(void)
 {
 	MDB_envinfo stat;
 
-	// Collect useful stats
 	unsigned size = get_pages_in_use();
 	mdb_env_info(env, &stat);
-	max_pages = stat.me_mapsize / size;
+	map_size = stat.me_mapsize;
+	max_pages = size ? stat.me_mapsize / size : 0;
+}
+
+
+static void close_db(void)
+{
+	// Collect useful stats
+	update_page_stats();
 	msg(LOG_DEBUG, "Database max pages: %lu", max_pages);
 	msg(LOG_DEBUG, "Database pages in use: %lu (%lu%%)", pages,
 	    max_pages ? ((100*pages)/max_pages) : 0);
+	msg(LOG_DEBUG, "Database lookups: %lu", lookups);
+	msg(LOG_DEBUG, "Database read txn renewals: %lu", lookup_renewals);
+	filter_size = bloom_size(&trust_filter);
+	filter_items = trust_filter.items;
+	filter_fp_rate = bloom_fp_rate(&trust_filter);
+	msg(LOG_DEBUG, "Trust filter size: %lu bytes", filter_size);
 
 	// Now close down
+	bloom_destroy(&trust_filter);
+	close_lookup_txn();
 	mdb_close(env, dbi);
 	mdb_env_close(env);
 }
 
 void database_report(FILE *f)
 {
+	fprintf(f, "Database map size: %zu MB\n", map_size / MEGABYTE);
+	fprintf(f, "Database map grows: %lu\n", map_grows);
 	fprintf(f, "Database max pages: %lu\n", max_pages);
-	fprintf(f, "Database pages in use: %lu (%lu%%)\n\n", pages,
+	fprintf(f, "Database pages in use: %lu (%lu%%)\n", pages,
 		max_pages ? ((100*pages)/max_pages) : 0);
+	fprintf(f, "Database lookups: %lu\n", lookups);
+	fprintf(f, "Database lookup avg time: %llu ns\n",
+		lookups ? lookup_ns_total / lookups : 0);
+	fprintf(f, "Database lookup max time: %llu ns\n", lookup_ns_max);
+	fprintf(f, "Database read txn renewals: %lu\n", lookup_renewals);
+	fprintf(f, "Trust filter size: %lu bytes (%lu keys)\n", filter_size,
+		filter_items);
+	fprintf(f, "Trust filter expected false positives: %.2f%%\n",
+		100.0 * filter_fp_rate);
+	fprintf(f, "Trust filter rejects: %lu\n", filter_rejects);
+	fprintf(f, "Trust filter false positives: %lu (%.2f%%)\n\n",
+		filter_false_pos,
+		(filter_rejects + filter_false_pos) ?
+		(100.0 * filter_false_pos) /
+				(filter_rejects + filter_false_pos) : 0.0);
 }
 
 
@@ -234,32 +392,83 @@ static void abort_transaction(MDB_txn *txn)
 
 /*
  * Convert path to a hash value. Used when the path exceeds the LMDB key
- * limit(511).  Note: Returned value must be deallocated.
+ * limit(511). The hex digest is written into the caller's buffer which
+ * must be at least HASH_KEY_SIZE bytes.
  */
-static char *path_to_hash(const char *path, const size_t path_len) MALLOCLIKE;
-static char *path_to_hash(const char *path, const size_t path_len)
+static void path_to_hash(const char *path, const size_t path_len, char *digest)
 {
-	gcry_md_hd_t h;
-	unsigned int len;
-	char *digest, *hptr;
+	char hptr[SHA512_LEN];
+
+	gcry_md_hash_buffer(GCRY_MD_SHA512, hptr, path, path_len);
+	bytes2hex(digest, hptr, SHA512_LEN);
+}
+
+
+/*
+ * Setup the lmdb key for a path. The path is first made canonical. If it
+ * is too long, it is converted to a hash. Either one is stored in buf
+ * which must be KEY_BUF_SIZE bytes.
+ */
+static void path_to_key(const char *path, MDB_val *key, char *buf)
+{
+	size_t len = canonical_trust_path(path, usr_aliases, buf,
+					  KEY_BUF_SIZE);
+
+	if (len)
+		path = buf;
+	else
+		len = strlen(path);
+
+	if (len > MDB_maxkeysize) {
+		path_to_hash(path, len, buf);
+		key->mv_data = (void *)buf;
+		key->mv_size = HASH_KEY_SIZE;
+	} else {
+		key->mv_data = (void *)path;
+		key->mv_size = len;
+	}
+}
 
-	if (gcry_md_open(&h, GCRY_MD_SHA512, GCRY_MD_FLAG_SECURE))
-		return NULL;
 
-	gcry_md_write(h, path, path_len);
-	hptr = (char *)gcry_md_read(h, GCRY_MD_SHA512);
+/*
+ * This function is called when a write txn failed with MDB_MAP_FULL. It
+ * doubles the map size, but not past db_size_limit if that is set. The
+ * map can only be resized when the process has no active txn. Writers
+ * hold the update lock, so the decision thread is not inside a lookup and
+ * its snapshot can be released. It returns 0 if the map grew and 1
+ * otherwise.
+ */
+static void release_lookup_txn(void);
+static int grow_map(void)
+{
+	MDB_envinfo stat;
+	size_t new_size;
+	int rc;
 
-	len = gcry_md_get_algo_dlen(GCRY_MD_SHA512) * sizeof(char);
-	digest = malloc((2 * len) + 1);
-	if (digest == NULL) {
-		gcry_md_close(h);
-		return digest;
+	if (mdb_env_info(env, &stat))
+		return 1;
+
+	new_size = stat.me_mapsize * 2;
+	if (map_limit && new_size > map_limit)
+		new_size = map_limit;
+	if (new_size <= stat.me_mapsize) {
+		msg(LOG_ERR, "db_size_limit needs to be increased");
+		return 1;
 	}
 
-	bytes2hex(digest, hptr, len);
-	gcry_md_close(h);
+	release_lookup_txn();
+	if ((rc = mdb_env_set_mapsize(env, new_size))) {
+		msg(LOG_ERR, "Cannot grow the database map (%s)",
+		    mdb_strerror(rc));
+		return 1;
+	}
+	// Make the lookup txn pick up the new map
+	db_generation++;
+	map_grows++;
+	msg(LOG_WARNING, "Database map grew from %zu to %zu MB",
+	    stat.me_mapsize / MEGABYTE, new_size / MEGABYTE);
 
-	return digest;
+	return 0;
 }
 
 
@@ -273,9 +482,9 @@ static int write_db(const char *idx, const char *data)
 	MDB_val key, value;
 	MDB_txn *txn;
 	int rc;
-	size_t len;
-	char *hash = NULL;
+	char buf[KEY_BUF_SIZE];
 
+retry:
 	if (mdb_txn_begin(env, NULL, 0, &txn))
 		return 1;
 
@@ -284,33 +493,26 @@ static int write_db(const char *idx, const char *data)
 		return 2;
 	}
 
-	len = strlen(idx);
-	if (len > MDB_maxkeysize) {
-		hash = path_to_hash(idx, len);
-		if (hash == NULL)
-			return 5;
-		key.mv_data = (void *)hash;
-		key.mv_size = gcry_md_get_algo_dlen(GCRY_MD_SHA512) * 2 + 1;
-	} else {
-		key.mv_data = (void *)idx;
-		key.mv_size = len;
-	}
+	path_to_key(idx, &key, buf);
 	value.mv_data = (void *)data;
 	value.mv_size = strlen(data);
 
 	if ((rc = mdb_put(txn, dbi, &key, &value, 0))) {
-		msg(LOG_ERR, "%s", mdb_strerror(rc));
 		abort_transaction(txn);
+		if (rc == MDB_MAP_FULL && grow_map() == 0)
+			goto retry;
+		msg(LOG_ERR, "%s", mdb_strerror(rc));
 		return 3;
 	}
 
 	if ((rc = mdb_txn_commit(txn))) {
+		if (rc == MDB_MAP_FULL && grow_map() == 0)
+			goto retry;
 		msg(LOG_ERR, "%s", mdb_strerror(rc));
 		return 4;
 	}
-
-	if (len > MDB_maxkeysize)
-		free(hash);
+	db_generation++;
+	bloom_add(&trust_filter, key.mv_data, key.mv_size);
 
 	return 0;
 }
@@ -363,6 +565,89 @@ static void end_long_term_read_ops(void)
 }
 
 
+/*
+ * Trust lookups from the decision thread share one read transaction and
+ * cursor that stay alive between lookups. The snapshot is only renewed
+ * when the database has been written to or when it gets too old, so that
+ * old pages are not pinned forever. Everything here must be called with
+ * the update lock held. The environment uses MDB_NOTLS which lets the
+ * update thread reset the txn before it rewrites the database.
+ */
+static MDB_txn *lookup_txn = NULL;
+static MDB_cursor *lookup_cursor = NULL;
+static int lookup_txn_active = 0;
+static unsigned long lookup_txn_gen;
+static time_t lookup_txn_start;
+static int start_lookup_txn(void)
+{
+	int rc;
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (lookup_txn_active) {
+		if (lookup_txn_gen == db_generation &&
+		    now.tv_sec - lookup_txn_start < LOOKUP_TXN_MAX_AGE)
+			return 0;
+		mdb_txn_reset(lookup_txn);
+		lookup_txn_active = 0;
+	}
+
+	if (lookup_txn == NULL) {
+		if ((rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &lookup_txn))) {
+			msg(LOG_ERR, "txn_begin:%s", mdb_strerror(rc));
+			lookup_txn = NULL;
+			return 1;
+		}
+		if ((rc = mdb_cursor_open(lookup_txn, dbi, &lookup_cursor))) {
+			msg(LOG_ERR, "cursor_open:%s", mdb_strerror(rc));
+			mdb_txn_abort(lookup_txn);
+			lookup_txn = NULL;
+			lookup_cursor = NULL;
+			return 1;
+		}
+	} else {
+		if ((rc = mdb_txn_renew(lookup_txn)) ||
+		    (rc = mdb_cursor_renew(lookup_txn, lookup_cursor))) {
+			msg(LOG_ERR, "txn_renew:%s", mdb_strerror(rc));
+			close_lookup_txn();
+			return 1;
+		}
+		lookup_renewals++;
+	}
+
+	lookup_txn_active = 1;
+	lookup_txn_gen = db_generation;
+	lookup_txn_start = now.tv_sec;
+
+	return 0;
+}
+
+
+/*
+ * Drop the lookup snapshot so that a writer doesn't have to preserve the
+ * pages it references. The next lookup renews it.
+ */
+static void release_lookup_txn(void)
+{
+	if (lookup_txn_active) {
+		mdb_txn_reset(lookup_txn);
+		lookup_txn_active = 0;
+	}
+}
+
+
+static void close_lookup_txn(void)
+{
+	if (lookup_cursor)
+		mdb_cursor_close(lookup_cursor);
+	lookup_cursor = NULL;
+	if (lookup_txn)
+		mdb_txn_abort(lookup_txn);
+	lookup_txn = NULL;
+	lookup_txn_active = 0;
+}
+
+
 static unsigned get_pages_in_use(void)
 {
 	MDB_stat stat;
@@ -391,91 +676,93 @@ static long get_number_of_entries(void)
 
 /*
  * This is the long term read operation. It takes a path as input and
- * search for the data. It returns NULL on error or if no data found.
- * The returned string must be freed by the caller.
+ * positions the cursor on its first data item. READ_DATA_FILTERED does the
+ * same but first asks the trust filter, it's only for the decision thread.
+ * READ_DATA_DUP moves the cursor to the next duplicate of the current key
+ * and ignores the index.
+ * The value points directly into the memory map and is only valid until
+ * the read transaction ends. It returns 1 if data is found, 0 if no data
+ * is found, and -1 on error.
  */
-static char *lt_read_db(const char *index, int operation, int *error) MALLOCLIKE;
-static char *lt_read_db(const char *index, int operation, int *error)
+static int lt_read_db(MDB_cursor *cursor, const char *index, int operation,
+	MDB_val *value)
 {
 	int rc;
-	char *data, *hash = NULL;
-	MDB_val key, value;
-	size_t len;
-	*error = 1; // Assume an error
+	MDB_val key;
+	char buf[KEY_BUF_SIZE];
 
-	// If the path is too long, convert to a hash
-	len = strlen(index);
-	if (len > MDB_maxkeysize) {
-		hash = path_to_hash(index, len);
-		if (hash == NULL)
-			return NULL;
-		key.mv_data = (void *)hash;
-		key.mv_size = gcry_md_get_algo_dlen(GCRY_MD_SHA512) * 2 + 1;
-	} else {
-		key.mv_data = (void *)index;
-		key.mv_size = len;
+	if (operation == READ_DATA_DUP) {
+		// is there a next duplicate?
+		rc = mdb_cursor_get(cursor, &key, value, MDB_NEXT_DUP);
+		if (rc == 0)
+			return 1;
+		if (rc == MDB_NOTFOUND)
+			return 0;
+		msg(LOG_ERR, "MDB_NEXT_DUP: cursor_get:%s", mdb_strerror(rc));
+		return -1;
 	}
-	value.mv_data = NULL;
-	value.mv_size = 0;
-
-	// set cursor and read first data
-	if (operation == READ_DATA || operation == READ_TEST_KEY) {
-
-		// Read the value pointed to by key
-		if ((rc = mdb_cursor_get(lt_cursor, &key, &value, MDB_SET))) {
-			free(hash);
-			if (rc == MDB_NOTFOUND) {
-				*error = 0;
-			} else {
-				msg(LOG_ERR, "MDB_SET: cursor_get:%s", mdb_strerror(rc));
-			}
-			return NULL;
-		}
 
+	// Read the value pointed to by key unless the filter rules it out
+	path_to_key(index, &key, buf);
+	if (operation == READ_DATA_FILTERED &&
+	    !bloom_check(&trust_filter, key.mv_data, key.mv_size)) {
+		filter_rejects++;
+		return 0;
 	}
-
-	// read next available data
-	// READ_DATA_DUP is supposed to be used
-	// as subsequent call just after READ_DATA
-	if (operation == READ_DATA_DUP) {
-		size_t nleaves;
-		mdb_cursor_count(lt_cursor, &nleaves);
-		if (nleaves <= 1) {
-			free(hash);
-			*error = 0;
-			return NULL;
-		}
-
-		// is there a next duplicate?
-		if ((rc = mdb_cursor_get(lt_cursor, &key, &value,
-					 MDB_NEXT_DUP))) {
-			free(hash);
-			if (rc == MDB_NOTFOUND) {
-				*error = 0;
-			} else {
-				msg(LOG_ERR, "MDB_NEXT_DUP: cursor_get:%s", mdb_strerror(rc));
-			}
-			return NULL;
-		}
+	rc = mdb_cursor_get(cursor, &key, value, MDB_SET);
+	if (rc == 0)
+		return 1;
+	if (rc == MDB_NOTFOUND) {
+		if (operation == READ_DATA_FILTERED && trust_filter.bits)
+			filter_false_pos++;
+		return 0;
 	}
+	msg(LOG_ERR, "MDB_SET: cursor_get:%s", mdb_strerror(rc));
+	return -1;
+}
 
-	if (len > MDB_maxkeysize)
-		free(hash);
 
-	// Failure was already returned. Need to return a pointer of
-	// some kind. Using the db name since its non-NULL.
-	// A next step might be to check the status field to see that its
-	// trusted.
-	*error = 0;
-	if (operation == READ_TEST_KEY)
-		return (char *)db;
+/*
+ * This function parses a DATA_FORMAT record without copying it. The data
+ * does not have to be NUL terminated. On success, sha points into the
+ * record and sha_len holds its length. It returns 0 on success and 1 if
+ * the record is malformed.
+ */
+int parse_trust_data(const char *data, size_t len, unsigned int *tsource,
+	off_t *size, const char **sha, size_t *sha_len)
+{
+	const char *ptr = data, *end = data + len;
+	unsigned long num;
 
-	if ((data = malloc(value.mv_size+1))) {
-		memcpy(data, value.mv_data, value.mv_size);
-		data[value.mv_size] = 0;
-	}
+	// source
+	while (ptr < end && *ptr == ' ')
+		ptr++;
+	if (ptr == end || *ptr < '0' || *ptr > '9')
+		return 1;
+	for (num = 0; ptr < end && *ptr >= '0' && *ptr <= '9'; ptr++)
+		num = num * 10 + (*ptr - '0');
+	*tsource = num;
+
+	// size
+	while (ptr < end && *ptr == ' ')
+		ptr++;
+	if (ptr == end || *ptr < '0' || *ptr > '9')
+		return 1;
+	for (num = 0; ptr < end && *ptr >= '0' && *ptr <= '9'; ptr++)
+		num = num * 10 + (*ptr - '0');
+	*size = num;
+
+	// sha256 - DATA_FORMAT pads it to 64 columns
+	while (ptr < end && *ptr == ' ')
+		ptr++;
+	*sha = ptr;
+	while (ptr < end && *ptr != ' ' && *ptr != 0)
+		ptr++;
+	*sha_len = ptr - *sha;
+	if (*sha_len == 0 || *sha_len > 64)
+		return 1;
 
-	return data;
+	return 0;
 }
 
 
@@ -534,6 +821,7 @@ static int delete_all_entries_db()
 	int rc = 0;
 	MDB_txn *txn;
 
+retry:
 	if (mdb_txn_begin(env, NULL, 0, &txn))
 		return 1;
 
@@ -544,24 +832,89 @@ static int delete_all_entries_db()
 
 	// 0 -> delete , 1 -> delete and close
 	if ((rc = mdb_drop(txn, dbi, 0))) {
-		msg(LOG_DEBUG, "mdb_drop -> %s", mdb_strerror(rc));
 		abort_transaction(txn);
+		if (rc == MDB_MAP_FULL && grow_map() == 0)
+			goto retry;
+		msg(LOG_DEBUG, "mdb_drop -> %s", mdb_strerror(rc));
 		return 3;
 	}
 
 	if ((rc = mdb_txn_commit(txn))) {
-		if (rc == MDB_MAP_FULL)
-			msg(LOG_ERR, "db_max_size needs to be increased");
-		else
-			msg(LOG_DEBUG, "mdb_txn_commit -> %s",
-			    mdb_strerror(rc));
+		if (rc == MDB_MAP_FULL && grow_map() == 0)
+			goto retry;
+		msg(LOG_DEBUG, "mdb_txn_commit -> %s", mdb_strerror(rc));
 		return 4;
 	}
+	db_generation++;
+	bloom_reset(&trust_filter);
 
 	return 0;
 }
 
 
+/*
+ * This function sizes the trust filter for the database with room to
+ * grow and loads every key into it. Lookups skip the database for keys
+ * the filter has never seen. If anything fails, the filter is left empty
+ * and all lookups go to the database. It returns 0 on success and 1 on
+ * failure.
+ */
+static int build_trust_filter(void)
+{
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	MDB_val key, value;
+	MDB_stat status;
+	int rc;
+
+	if (mdb_env_stat(env, &status))
+		return 1;
+
+	if (bloom_create(&trust_filter, 2 * status.ms_entries)) {
+		msg(LOG_ERR, "Cannot allocate the trust filter");
+		return 1;
+	}
+
+	if (mdb_txn_begin(env, NULL, MDB_RDONLY, &txn))
+		goto err;
+	if (mdb_cursor_open(txn, dbi, &cursor)) {
+		mdb_txn_abort(txn);
+		goto err;
+	}
+
+	rc = mdb_cursor_get(cursor, &key, &value, MDB_FIRST);
+	while (rc == 0) {
+		bloom_add(&trust_filter, key.mv_data, key.mv_size);
+		rc = mdb_cursor_get(cursor, &key, &value, MDB_NEXT_NODUP);
+	}
+	mdb_cursor_close(cursor);
+	mdb_txn_abort(txn);
+	if (rc != MDB_NOTFOUND) {
+		msg(LOG_ERR, "Cannot read keys for the trust filter (%s)",
+		    mdb_strerror(rc));
+		goto err;
+	}
+
+	msg(LOG_DEBUG, "Trust filter has %lu keys in %zu bytes",
+	    trust_filter.items, bloom_size(&trust_filter));
+	return 0;
+err:
+	bloom_destroy(&trust_filter);
+	return 1;
+}
+
+
+/*
+ * When more keys have been added than the filter was sized for, its
+ * false positive rate climbs. Rebuild it from the database in that case.
+ */
+static void check_trust_filter(void)
+{
+	if (trust_filter.items > trust_filter.capacity)
+		build_trust_filter();
+}
+
+
 static int create_database(int with_sync)
 {
 	msg(LOG_INFO, "Creating database");
@@ -583,6 +936,10 @@ static int create_database(int with_sync)
 	// Flush everything to disk
 	if (with_sync)
 		mdb_env_sync(env, 1);
+
+	update_page_stats();
+	msg(LOG_INFO, "Database pages in use: %lu of %lu (%lu%%)", pages,
+	    max_pages, max_pages ? ((100*pages)/max_pages) : 0);
 	return rc;
 }
 
@@ -593,28 +950,27 @@ static int create_database(int with_sync)
 static int check_data_presence(const char * index, const char * data, int * matched)
 {
 	int found = 0;
-	int error;
-	char *read;
+	int rc;
 	int operation = READ_DATA;
 	int cnt = 0;
+	size_t len = strlen(data);
+	MDB_val value;
 
 	while (1) {
-		error = 0;
-		read = NULL;
-		read = lt_read_db(index, operation, &error);
+		rc = lt_read_db(lt_cursor, index, operation, &value);
 
-		if (error)
+		if (rc < 0)
 			msg(LOG_DEBUG, "Error when reading from DB!");
 
-		if (!read)
+		if (rc <= 0)
 			break;
 
-		// check strings
-		if (strcmp(data, read) == 0) {
+		// compare in place
+		if (value.mv_size == len &&
+				memcmp(data, value.mv_data, len) == 0) {
 			found = 1;
 		}
 
-		free(read);
 		cnt++;
 
 		if (found)
@@ -631,13 +987,17 @@ static int check_data_presence(const char * index, const char * data, int * matc
 
 /*
  * This function will compare the backend database against our copy
- * of the database. It returns a 1 if they do not match, 0 if they do
- * match, and -1 if there is an error.
+ * of the database. Entries that are only missing from our copy are
+ * added to it. It returns a 1 if they still do not match and the
+ * database needs to be rebuilt, 0 if they do match, and -1 if there is
+ * an error.
  */
 static int check_database_copy(void)
 {
 	msg(LOG_INFO, "Checking database");
 	long problems = 0;
+	list_t added;
+	list_item_t *next;
 
 	if (start_long_term_read_ops())
 		return -1;
@@ -645,6 +1005,9 @@ static int check_database_copy(void)
 	long backend_total_entries = 0;
 	long backend_added_entries = 0;
 
+	// The items point at backend strings, don't use list_empty on it
+	list_init(&added);
+
 	for (backend_entry *be = backend_get_first() ; be != NULL ;
 							 be = be->next ) {
 		msg(LOG_INFO, "Importing data from %s backend",
@@ -666,6 +1029,8 @@ static int check_database_copy(void)
 				if (matched == 0) {
 					msg(LOG_DEBUG, "%s is not in database", (char*)item->index);
 					backend_added_entries++;
+					list_append(&added, item->index,
+						    item->data);
 				}
 
 				// updated file
@@ -682,8 +1047,10 @@ static int check_database_copy(void)
 
 	long db_total_entries = get_number_of_entries();
 	// something wrong
-	if (db_total_entries == -1)
-		return -1;
+	if (db_total_entries == -1) {
+		problems = -1;
+		goto out;
+	}
 
 	msg(	LOG_INFO,
 		"Entries in DB: %ld",
@@ -707,6 +1074,28 @@ static int check_database_copy(void)
 
 	problems += removed;
 
+	// If new files are the only difference, just add them
+	if (problems && problems == backend_added_entries &&
+					added.count == backend_added_entries) {
+		lock_update_thread();
+		for (list_item_t *item = added.first; item; item = item->next) {
+			write_db(item->index, item->data);
+			invalidate_trust_path(item->index);
+		}
+		check_trust_filter();
+		unlock_update_thread();
+		msg(LOG_INFO, "Added %ld entries", backend_added_entries);
+		problems = 0;
+	}
+
+out:
+	for (list_item_t *item = added.first; item; item = next) {
+		next = item->next;
+		free(item);
+	}
+
+	if (problems < 0)
+		return -1;
 	if (problems) {
 		msg(LOG_WARNING, "Found %ld problems", problems);
 		return 1;
@@ -736,11 +1125,127 @@ int unlink_db(void)
 		msg(LOG_ERR, "Could not unlink %s (%s)", path, strerror(errno));
 		ret_val = 1;
 	}
+	snprintf(path, sizeof(path), "%s/db.stamp", data_dir);
+	unlink(path);
 
 	return ret_val;
 }
 
 
+/*
+ * The backend stamps that the database was last synced with are kept in
+ * db.stamp next to db.ver. The daemon version is part of it because it
+ * decides what gets loaded from the backends. If the current stamps
+ * match, loading and checking the backends can be skipped.
+ */
+// Set when db.stamp is known to describe the database. The update thread
+// changes it while the main thread reads it.
+static atomic_int stamps_valid = 0;
+static int get_stamps(char *buf, size_t size)
+{
+	int len = snprintf(buf, size, "fapolicyd %s\n", VERSION);
+
+	if (len < 0 || (size_t)len >= size)
+		return 1;
+	return backend_stamps(buf + len, size - len);
+}
+
+
+// Read the saved stamps into buf. Returns 0 on success, 1 otherwise.
+static int read_stamps(char *buf, size_t size)
+{
+	char path[64];
+	ssize_t len;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/db.stamp", data_dir);
+	fd = open(path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0)
+		return 1;
+	len = read(fd, buf, size - 1);
+	close(fd);
+	if (len <= 0)
+		return 1;
+	buf[len] = 0;
+
+	return 0;
+}
+
+
+// Returns 1 if the saved stamps are the same as stamps, 0 otherwise
+static int stamps_match(const char *stamps)
+{
+	char buf[STAMP_SIZE];
+
+	if (read_stamps(buf, sizeof(buf)))
+		return 0;
+
+	return strcmp(buf, stamps) == 0;
+}
+
+
+/*
+ * If the database is known to match its backends, the stamps it was
+ * synced with are written to buf and 0 is returned. Two equal stamps
+ * mean the same trust. It returns 1 if the database may have changed.
+ */
+int database_stamps(char *buf, size_t size)
+{
+	if (!stamps_valid)
+		return 1;
+	return read_stamps(buf, size);
+}
+
+
+// Write the stamps to a temporary file and rename it over the old one.
+// The environment doesn't sync on commit, so the entries the stamps vouch
+// for are flushed first.
+static void save_stamps(const char *stamps)
+{
+	char path[64], tmp[64];
+	size_t len = strlen(stamps);
+	int fd, rc;
+
+	if ((rc = mdb_env_sync(env, 1))) {
+		msg(LOG_WARNING, "Cannot sync the database (%s)",
+		    mdb_strerror(rc));
+		return;
+	}
+
+	snprintf(path, sizeof(path), "%s/db.stamp", data_dir);
+	snprintf(tmp, sizeof(tmp), "%s/db.stamp.tmp", data_dir);
+	fd = open(tmp, O_CREAT|O_TRUNC|O_WRONLY|O_CLOEXEC, 0640);
+	if (fd < 0) {
+		msg(LOG_WARNING, "Cannot write %s (%s)", tmp, strerror(errno));
+		return;
+	}
+	if (write(fd, stamps, len) != (ssize_t)len || fsync(fd)) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+	close(fd);
+	if (rename(tmp, path)) {
+		unlink(tmp);
+		return;
+	}
+	stamps_valid = 1;
+}
+
+
+// The database no longer matches the backends exactly
+static void drop_stamps(void)
+{
+	char path[64];
+
+	if (!stamps_valid)
+		return;
+	snprintf(path, sizeof(path), "%s/db.stamp", data_dir);
+	unlink(path);
+	stamps_valid = 0;
+}
+
+
 /*
  * DB version 1 = unique keys (0.8 - 0.9.2)
  * DB version 2 = allow duplicate keys (0.9.3 - )
@@ -796,9 +1301,11 @@ static int migrate_database(void)
  */
 int init_database(conf_t *config)
 {
-	int rc;
+	int rc, stamped;
+	char stamps[STAMP_SIZE];
 
 	msg(LOG_INFO, "Initializing the database");
+	clock_gettime(CLOCK_MONOTONIC, &startup_time);
 
 	// update_lock is used in update_database()
 	pthread_mutex_init(&update_lock, NULL);
@@ -811,20 +1318,25 @@ int init_database(conf_t *config)
 		return rc;
 	}
 
-	if ((rc = backend_init(config))) {
-		msg(LOG_ERR, "Failed to load data from backend (%d)", rc);
-		close_db();
-		return rc;
-	}
-
-	if ((rc = backend_load())) {
-		msg(LOG_ERR, "Failed to load data from backend (%d)", rc);
-		close_db();
-		return rc;
-	}
-
 	rc = database_empty();
 	if (rc > 0) {
+		// Nothing to make decisions with yet, so build it right now
+		if ((rc = backend_init(config))) {
+			msg(LOG_ERR, "Failed to load data from backend (%d)",
+			    rc);
+			close_db();
+			return rc;
+		}
+
+		// Stamp the backends before loading in case they change
+		stamped = !get_stamps(stamps, sizeof(stamps));
+		if ((rc = backend_load())) {
+			msg(LOG_ERR, "Failed to load data from backend (%d)",
+			    rc);
+			close_db();
+			return rc;
+		}
+
 		if ((rc = create_database(/*with_sync*/1))) {
 			msg(LOG_ERR,
 			   "Failed to create database, create_database() (%d)",
@@ -832,21 +1344,100 @@ int init_database(conf_t *config)
 			close_db();
 			return rc;
 		}
+
+		// Conserve memory by dumping the linked lists
+		backend_close();
+		if (stamped)
+			save_stamps(stamps);
+		verified_time = elapsed_since(&startup_time);
+		msg(LOG_INFO, "Trust database created after %.3fs",
+		    verified_time);
 	} else {
-		// check if our internal database is synced
-		rc = check_database_copy();
-		if (rc > 0) {
-			rc = update_database(config);
-			if (rc)
-				msg(LOG_ERR,
-				    "Failed updating the trust database");
-		}
+		// If the backends did not change while we were down, the
+		// stamps are valid before the update thread gets to them.
+		// The object snapshot needs this to restore trust.
+		if (backend_init(config) == 0 &&
+		    !get_stamps(stamps, sizeof(stamps)) && stamps_match(stamps))
+			stamps_valid = 1;
+		backend_close();
+
+		// Enforce from the existing database while the update
+		// thread checks it against the backends
+		verify_pending = 1;
+	}
+
+	build_trust_filter();
+
+	pthread_create(&update_thread, NULL, update_thread_main, config);
+
+	return 0;
+}
+
+
+/*
+ * This function runs on the update thread when the daemon started from
+ * an existing database. It loads the backends and makes the database
+ * match them while decisions are already being made. The database is
+ * left as it was if the backends cannot be loaded. It returns 0 on
+ * success and non-zero if the database could not be updated.
+ */
+static int verify_database(conf_t *config)
+{
+	int rc, stamped;
+	char stamps[STAMP_SIZE];
+
+	if ((rc = backend_init(config))) {
+		msg(LOG_ERR, "Failed to load data from backend (%d)", rc);
+		backend_close();
+		return 0;
+	}
+
+	stamped = !get_stamps(stamps, sizeof(stamps));
+	if (stamped && stamps_match(stamps)) {
+		msg(LOG_INFO, "Trust sources are unchanged, skipping checks");
+		backend_close();
+		stamps_valid = 1;
+		rc = 0;
+		goto verified;
 	}
 
+	// The database is about to be brought in line with new stamps
+	drop_stamps();
+
+	if ((rc = backend_load())) {
+		msg(LOG_ERR, "Failed to load data from backend (%d)", rc);
+		backend_close();
+		return 0;
+	}
+
+	// check if our internal database is synced
+	rc = check_database_copy();
+	if (rc < 0) {
+		msg(LOG_ERR, "Cannot check the trust database");
+		backend_close();
+		return 1;
+	}
+	if (rc > 0)
+		rc = update_database(config);
+
 	// Conserve memory by dumping the linked lists
 	backend_close();
+	if (rc == 0 && stamped)
+		save_stamps(stamps);
 
-	pthread_create(&update_thread, NULL, update_thread_main, config);
+verified:
+	if (rc == 0) {
+		lock_update_thread();
+		verified_time = elapsed_since(&startup_time);
+		if (first_decision_time >= 0)
+			msg(LOG_INFO, "Trust database verified after %.3fs, "
+			    "first decision after %.3fs", verified_time,
+			    first_decision_time);
+		else
+			msg(LOG_INFO, "Trust database verified after %.3fs",
+			    verified_time);
+		unlock_update_thread();
+	}
 
 	return rc;
 }
@@ -859,113 +1450,77 @@ int init_database(conf_t *config)
  * data is found or if the integrity check has failed. There is no
  * distinguishing which is the case since both mean you cannot trust the file.
  * It returns a 1 if the file is found and trustworthy. Callers have to
- * check the error variable before trusting it's results.
+ * check the error variable before trusting it's results. The records are
+ * compared in place while walking the duplicates so nothing is allocated.
  */
 static int read_trust_db(const char *path, int *error, struct file_info *info,
 	int fd)
 {
-	int do_integrity = 0, mode = READ_TEST_KEY;
-	char *res;
-	int retry = 0;
+	int rc, cnt = 0;
+	MDB_val value;
 	char sha_xattr[65];
 
-	if (integrity != IN_NONE && info) {
-		do_integrity = 1;
-		mode = READ_DATA;
-		sha_xattr[0] = 0; // Make sure we can't re-use stack value
-	}
-
-retry_res:
-	retry++;
-
-	if (retry >= 128) {
-		msg(LOG_ERR, "Checked 128 duplicates for %s "
-			"and there is no match. Breaking the cycle.", path);
+	*error = 0;
+	rc = lt_read_db(lookup_cursor, path, READ_DATA_FILTERED, &value);
+	if (rc < 0) {
 		*error = 1;
 		return 0;
 	}
 
-	res = lt_read_db(path, mode, error);
+	// record not found or no integrity checking - we are done
+	if (rc == 0 || integrity == IN_NONE || info == NULL)
+		return rc;
 
-	if (!do_integrity) {
-		return res ? 1 : 0;
-	} else {
+	// Get the file's fingerprint one time
+	if (integrity == IN_IMA) {
+		if (get_ima_hash(fd, sha_xattr) == 0) {
+			*error = 1;
+			return 0;
+		}
+	} else if (integrity == IN_SHA256) {
+		char *hash = get_hash_from_fd(fd);
+		if (hash == NULL) {
+			*error = 1;
+			return 0;
+		}
+		strncpy(sha_xattr, hash, 64);
+		sha_xattr[64] = 0;
+		free(hash);
+	}
+
+	do {
 		unsigned int tsource;
 		off_t size;
-		char sha[65];
+		const char *sha;
+		size_t sha_len;
 
-		// record not found
-		if (res == NULL)
-			return 0;
-
-		if (sscanf(res, DATA_FORMAT, &tsource, &size, sha) != 3) {
-			free(res);
+		if (parse_trust_data(value.mv_data, value.mv_size, &tsource,
+						&size, &sha, &sha_len)) {
 			*error = 1;
 			return 1;
 		}
 
-		// Need to do the compare and free res
-		free(res);
-
-		// prepare for next reading
-		if (mode != READ_DATA_DUP)
-			mode = READ_DATA_DUP;
-
-		if (integrity == IN_SIZE) {
-
-			// match!
-			if (size == info->size) {
+		// match!
+		if (size == info->size) {
+			if (integrity == IN_SIZE)
 				return 1;
-			} else {
-				goto retry_res;
-			}
-
-		} else if (integrity == IN_IMA) {
-			int rc = 1;
-
-			// read xattr only the first time
-			if (retry == 1)
-				rc = get_ima_hash(fd, sha_xattr);
-
-			if (rc) {
-				if ((size == info->size) &&
-					(strcmp(sha, sha_xattr) == 0)) {
-					return 1;
-				} else {
-					goto retry_res;
-				}
-
-			} else {
-				*error = 1;
-				return 0;
-			}
-
-		} else if (integrity == IN_SHA256) {
-			char *hash = NULL;
-
-			// Calculate a hash only one time
-			if (retry == 1) {
-				hash = get_hash_from_fd(fd);
-				if (hash) {
-					strncpy(sha_xattr, hash, 64);
-					sha_xattr[64] = 0;
-					free(hash);
-				} else {
-					*error = 1;
-					return 0;
-				}
-			}
-
-			if ((size == info->size) &&
-				(strcmp(sha, sha_xattr) == 0))
+			if (sha_len == 64 && memcmp(sha, sha_xattr, 64) == 0)
 				return 1;
-			else {
-				goto retry_res;
-			}
 		}
-	}
 
-	*error = 1;
+		if (++cnt >= MAX_DUPS) {
+			msg(LOG_ERR, "Checked %d duplicates for %s "
+				"and there is no match. Breaking the cycle.",
+				MAX_DUPS, path);
+			*error = 1;
+			return 0;
+		}
+	} while ((rc = lt_read_db(lookup_cursor, path, READ_DATA_DUP,
+							&value)) > 0);
+
+	if (rc < 0)
+		*error = 1;
+
 	return 0;
 }
 
@@ -974,51 +1529,59 @@ int check_trust_database(const char *path, struct file_info *info, int fd)
 {
 	int retval = 0, error;
 	int res;
+	struct timespec start, end;
+	unsigned long long elapsed;
 
 	// this function is going to be used from decision_thread
 	// that means we need to be sure database won't change under
 	// our hands
 	lock_update_thread();
 
-	if (start_long_term_read_ops())
+	if (start_lookup_txn()) {
+		unlock_update_thread();
 		return -1;
+	}
 
+	if (first_decision_time < 0) {
+		first_decision_time = elapsed_since(&startup_time);
+		if (verified_time < 0)
+			msg(LOG_INFO, "First trust decision after %.3fs, "
+			    "database is being verified", first_decision_time);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	// Paths are stored under their /usr name, so one lookup is enough
 	res = read_trust_db(path, &error, info, fd);
 	if (error)
 		retval = -1;
 	else if (res)
 		retval = 1;
-	else if (lib64_symlink || lib_symlink || bin_symlink || sbin_symlink) {
-		// If we are on a system that symlinks the top level
-		// directories to /usr, then let's try again without the /usr
-		// dir. There shouldn't be many packages that have this
-		// problem. These are sorted from most likely to least.
-		if (strncmp(path, "/usr/", 5) == 0) {
-			if ((lib64_symlink &&
-			     strncmp(&path[5], "lib64/", 6) == 0) ||
-			    (lib_symlink &&
-			     strncmp(&path[5], "lib/", 4) == 0) ||
-			    (bin_symlink &&
-			     strncmp(&path[5], "bin/", 4) == 0) ||
-			    (sbin_symlink &&
-			     strncmp(&path[5], "sbin/", 5) == 0)) {
-				// We have a symlink, retry
-				res = read_trust_db(&path[4], &error, info, fd);
-				if (error)
-					retval = -1;
-				else if (res)
-					retval = 1;
-			}
-		}
-	}
 
-	end_long_term_read_ops();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed = (end.tv_sec - start.tv_sec) * 1000000000ULL +
+			end.tv_nsec - start.tv_nsec;
+	lookups++;
+	lookup_ns_total += elapsed;
+	if (elapsed > lookup_ns_max)
+		lookup_ns_max = elapsed;
+
 	unlock_update_thread();
 
 	return retval;
 }
 
 
+// Give back the pages the lookup snapshot holds. If the update thread is
+// busy, it is left alone since a write releases the snapshot anyway.
+void database_release_snapshot(void)
+{
+	if (pthread_mutex_trylock(&update_lock))
+		return;
+	release_lookup_txn();
+	unlock_update_thread();
+}
+
+
 void close_database(void)
 {
 	pthread_join(update_thread, NULL);
@@ -1078,6 +1641,9 @@ static int update_database(conf_t *config)
 
 	lock_update_thread();
 
+	// Don't make the rewrite preserve the old snapshot's pages
+	release_lookup_txn();
+
 	if ((rc = delete_all_entries_db())) {
 		msg(LOG_ERR, "Cannot delete database (%d)", rc);
 		unlock_update_thread();
@@ -1085,6 +1651,7 @@ static int update_database(conf_t *config)
 	}
 
 	rc = create_database(/*with_sync*/0);
+	check_trust_filter();
 
 	// signal that cache need to be flushed
 	needs_flush = true;
@@ -1101,6 +1668,276 @@ static int update_database(conf_t *config)
 	return 0;
 }
 
+/*
+ * Reload every backend and rebuild the database from them. The daemon
+ * exits if the database cannot be rebuilt.
+ */
+static void reload_database(conf_t *config)
+{
+	int rc, stamped;
+	char stamps[STAMP_SIZE];
+
+	backend_close();
+	backend_init(config);
+	stamped = !get_stamps(stamps, sizeof(stamps));
+	backend_load();
+
+	if ((rc = update_database(config))) {
+		msg(LOG_ERR, "Cannot update a database!");
+		close(ffd[0].fd);
+		backend_close();
+		unlink_fifo();
+		exit(rc);
+	} else {
+		msg(LOG_INFO, "Updated");
+		if (stamped)
+			save_stamps(stamps);
+	}
+
+	// Conserve memory
+	backend_close();
+}
+
+
+/*
+ * The rpm records of every path in paths are replaced by the records
+ * for those paths in the list. Records from other sources are kept. It
+ * is all done in one txn. The caller must hold the update lock. It
+ * returns 0 on success and non-zero on error.
+ */
+static int apply_rpm_changes(const list_t *paths, const list_t *records)
+{
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	MDB_val key, value;
+	list_item_t *item;
+	char buf[KEY_BUF_SIZE];
+	int rc;
+
+retry:
+	if (mdb_txn_begin(env, NULL, 0, &txn))
+		return 1;
+	if (open_dbi(txn) || mdb_cursor_open(txn, dbi, &cursor)) {
+		abort_transaction(txn);
+		return 2;
+	}
+
+	// Drop the old rpm records. They are copied out first because the
+	// values point into the map and the cursor moves on a delete.
+	for (item = list_get_first(paths); item; item = item->next) {
+		char old[MAX_DUPS][RECORD_SIZE];
+		size_t old_len[MAX_DUPS];
+		int i, cnt = 0;
+
+		path_to_key(item->index, &key, buf);
+		rc = mdb_cursor_get(cursor, &key, &value, MDB_SET);
+		while (rc == 0 && cnt < MAX_DUPS) {
+			unsigned int tsource;
+			off_t size;
+			const char *sha;
+			size_t sha_len;
+
+			if (value.mv_size < RECORD_SIZE &&
+			    parse_trust_data(value.mv_data, value.mv_size,
+					&tsource, &size, &sha, &sha_len) == 0 &&
+			    tsource == SRC_RPM) {
+				memcpy(old[cnt], value.mv_data, value.mv_size);
+				old_len[cnt++] = value.mv_size;
+			}
+			rc = mdb_cursor_get(cursor, &key, &value,
+					    MDB_NEXT_DUP);
+		}
+		if (rc && rc != MDB_NOTFOUND)
+			goto err;
+
+		path_to_key(item->index, &key, buf);
+		for (i = 0; i < cnt; i++) {
+			value.mv_data = old[i];
+			value.mv_size = old_len[i];
+			rc = mdb_del(txn, dbi, &key, &value);
+			if (rc && rc != MDB_NOTFOUND)
+				goto err;
+		}
+	}
+
+	// Write the new ones
+	for (item = list_get_first(records); item; item = item->next) {
+		path_to_key(item->index, &key, buf);
+		value.mv_data = (void *)item->data;
+		value.mv_size = strlen(item->data);
+		rc = mdb_put(txn, dbi, &key, &value, MDB_NODUPDATA);
+		if (rc && rc != MDB_KEYEXIST)
+			goto err;
+	}
+
+	mdb_cursor_close(cursor);
+	if ((rc = mdb_txn_commit(txn))) {
+		if (rc == MDB_MAP_FULL && grow_map() == 0)
+			goto retry;
+		msg(LOG_ERR, "%s", mdb_strerror(rc));
+		return 4;
+	}
+	db_generation++;
+
+	for (item = list_get_first(records); item; item = item->next) {
+		path_to_key(item->index, &key, buf);
+		bloom_add(&trust_filter, key.mv_data, key.mv_size);
+	}
+
+	return 0;
+err:
+	mdb_cursor_close(cursor);
+	abort_transaction(txn);
+	if (rc == MDB_MAP_FULL && grow_map() == 0)
+		goto retry;
+	msg(LOG_ERR, "%s", mdb_strerror(rc));
+	return 3;
+}
+
+
+/*
+ * The dnf plugin describes a transaction with one line per item and a
+ * line with a single dot at the end:
+ *   +name-version-release.arch	a package that was installed
+ *   -/path/to/file		a file of a package that was erased
+ * The first part has already been read into buff. The rest is read from
+ * the fifo. It returns the whole message or NULL if it was not complete.
+ */
+#define TRANSACTION_TIMEOUT 5
+static char *read_transaction(const char *buff, ssize_t count)
+{
+	size_t len = count, size = count + BUFFER_SIZE;
+	char *msg_buf = malloc(size);
+	int waited = 0;
+
+	if (msg_buf == NULL)
+		return NULL;
+	memcpy(msg_buf, buff, len);
+	msg_buf[len] = 0;
+
+	while (!(len >= 3 && strcmp(&msg_buf[len-3], "\n.\n") == 0)) {
+		int rc = poll(ffd, 1, 1000);
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc <= 0) {
+			if (rc == 0 && ++waited < TRANSACTION_TIMEOUT)
+				continue;
+			goto err;
+		}
+		if (size - len < BUFFER_SIZE) {
+			char *tmp = realloc(msg_buf, size * 2);
+			if (tmp == NULL)
+				goto err;
+			msg_buf = tmp;
+			size *= 2;
+		}
+		count = read(ffd[0].fd, &msg_buf[len], BUFFER_SIZE - 1);
+		if (count <= 0) {
+			if (count == 0 && ++waited < TRANSACTION_TIMEOUT) {
+				// No writer, don't spin on POLLHUP
+				sleep(1);
+				continue;
+			}
+			goto err;
+		}
+		len += count;
+		msg_buf[len] = 0;
+	}
+
+	return msg_buf;
+err:
+	msg(LOG_WARNING, "Incomplete package transaction received");
+	free(msg_buf);
+	return NULL;
+}
+
+
+/*
+ * This function updates the database with only what a package
+ * transaction changed. It returns 0 on success and 1 if the whole
+ * database has to be reloaded instead.
+ */
+static int handle_transaction(conf_t *config, const char *buff,
+	ssize_t count)
+{
+	char *text, *line, *saved;
+	list_t packages, paths;
+	list_item_t *item;
+	backend_entry *be;
+	struct path_set seen;
+	int rc = 1;
+
+	text = read_transaction(buff, count);
+	if (text == NULL)
+		return 1;
+	if (path_set_init(&seen, 0)) {
+		free(text);
+		return 1;
+	}
+
+	// The list items own strdup'ed copies
+	list_init(&packages);
+	list_init(&paths);
+	for (line = strtok_r(text, "\n", &saved); line;
+					line = strtok_r(NULL, "\n", &saved)) {
+		char *copy;
+
+		if (line[0] != '+' && line[0] != '-')
+			continue;
+		copy = strdup(line + 1);
+		if (copy == NULL)
+			goto out;
+		if (line[0] == '+') {
+			if (list_append(&packages, copy, NULL)) {
+				free(copy);
+				goto out;
+			}
+		} else if (copy[0] != '/' || path_set_contains(&seen, copy) ||
+			   list_append(&paths, copy, NULL))
+			free(copy);
+		else if (path_set_add(&seen, copy) < 0)
+			goto out;
+	}
+	path_set_destroy(&seen);
+	msg(LOG_INFO, "Package transaction: %ld installed, %ld files erased",
+	    packages.count, paths.count);
+
+	backend_close();
+	backend_init(config);
+	for (be = backend_get_first(); be; be = be->next)
+		if (be->backend->load_changes)
+			break;
+	// Only rpm knows packages. Without it, do what we always did.
+	if (be == NULL || be->backend->load_changes(&packages, &paths))
+		goto out;
+
+	lock_update_thread();
+	rc = apply_rpm_changes(&paths, &be->backend->list);
+	check_trust_filter();
+	unlock_update_thread();
+
+	// Only the paths of the transaction changed trust
+	for (item = list_get_first(&paths); item; item = item->next)
+		invalidate_trust_path(item->index);
+	for (item = list_get_first(&be->backend->list); item;
+							item = item->next)
+		invalidate_trust_path(item->index);
+	if (rc == 0)
+		msg(LOG_INFO, "Updated %ld paths from %ld records",
+		    paths.count, be->backend->list.count);
+	else
+		rc = 1;
+out:
+	path_set_destroy(&seen);
+	backend_close();
+	list_empty(&packages);
+	list_empty(&paths);
+	free(text);
+	return rc;
+}
+
+
 static int handle_record(const char * buffer)
 {
 	char path[2048+1];
@@ -1126,7 +1963,12 @@ static int handle_record(const char * buffer)
 	msg(LOG_DEBUG, "update_thread: Saving %s %s", path, data);
 	lock_update_thread();
 	write_db(path, data);
+	check_trust_filter();
 	unlock_update_thread();
+	invalidate_trust_path(path);
+
+	// The database now has an entry that the backends don't
+	drop_stamps();
 
 	return 0;
 }
@@ -1159,6 +2001,16 @@ static void *update_thread_main(void *arg)
 
 	ffd[0].events = POLLIN;
 
+	if (verify_pending) {
+		verify_pending = 0;
+		if ((rc = verify_database(config))) {
+			msg(LOG_ERR, "Cannot update a database!");
+			close(ffd[0].fd);
+			unlink_fifo();
+			exit(rc);
+		}
+	}
+
 	while (!stop) {
 
 		rc = poll(ffd, 1, 1000);
@@ -1209,7 +2061,10 @@ static void *update_thread_main(void *arg)
 				msg(LOG_DEBUG, "Buffer contains: \"%s\"", buff);
 #endif
 				int operation = 0;
-				for (int i = 0 ; i < count ; i++) {
+				// got "+" or "-" -> package transaction
+				if (buff[0] == '+' || buff[0] == '-')
+					operation = 3;
+				for (int i = 0 ; !operation && i < count ; i++) {
 					// assume file name
 					// operation = 0
 					if (buff[i] == '/')
@@ -1230,26 +2085,14 @@ static void *update_thread_main(void *arg)
 				if (operation == 1) {
 					msg(LOG_INFO,
 	    "It looks like there was an update of the system... Syncing DB.");
-
-					backend_close();
-					backend_init(config);
-					backend_load();
-
-					if ((rc = update_database(config))) {
-						msg(LOG_ERR,
-						   "Cannot update a database!");
-						close(ffd[0].fd);
-						backend_close();
-						unlink_fifo();
-						exit(rc);
-					} else
-						msg(LOG_INFO, "Updated");
-
-					// Conserve memory
-					backend_close();
+					reload_database(config);
 				// got "2" -> flush cache
 				} else if (operation == 2) {
 					needs_flush = true;
+				} else if (operation == 3) {
+					if (handle_transaction(config, buff,
+							       count))
+						reload_database(config);
 				} else {
 					if (handle_record(buff))
 						continue;
@@ -30,8 +30,15 @@
 #include "file.h"
 
 #define DB_DIR "/var/lib/fapolicyd"
+#define STAMP_SIZE 512
 #define DB_NAME "trust.db"
 
+// Top level directories that are symlinks into /usr
+#define USR_ALIAS_LIB	0x01
+#define USR_ALIAS_LIB64	0x02
+#define USR_ALIAS_BIN	0x04
+#define USR_ALIAS_SBIN	0x08
+
 void lock_update_thread(void);
 void unlock_update_thread(void);
 
@@ -39,8 +46,15 @@ const char *lookup_tsource(unsigned int tsource);
 int preconstruct_fifo(const conf_t *config);
 int init_database(conf_t *config);
 int check_trust_database(const char *path, struct file_info *info, int fd);
+int parse_trust_data(const char *data, size_t len, unsigned int *tsource,
+	off_t *size, const char **sha, size_t *sha_len);
+size_t canonical_trust_path(const char *path, unsigned int aliases,
+	char *buf, size_t size);
+const char *trust_db_path(const char *path, char *buf, size_t size);
+void database_release_snapshot(void);
 void close_database(void);
 void database_report(FILE *f);
+int database_stamps(char *buf, size_t size);
 int unlink_db(void);
 void unlink_fifo(void);
 
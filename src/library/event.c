@@ -27,17 +27,26 @@
 #include <string.h>
 #include <limits.h>
 #include <sys/fanotify.h>
+#include <pthread.h>
 #include <stdatomic.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysinfo.h>
+#include <malloc.h>
 
 #include "event.h"
 #include "database.h"
 #include "file.h"
+#include "intern.h"
 #include "lru.h"
 #include "message.h"
+#include "slab.h"
 
 #define ALL_EVENTS (FAN_ALL_EVENTS|FAN_OPEN_PERM|FAN_ACCESS_PERM| \
 	FAN_OPEN_EXEC_PERM)
@@ -45,48 +54,482 @@
 static Queue *subj_cache = NULL;
 static Queue *obj_cache = NULL;
 
+// Cache entries come from these so a miss doesn't call malloc
+static slab_t subj_slab;
+static slab_t obj_slab;
+static pthread_mutex_t slab_lock = PTHREAD_MUTEX_INITIALIZER;
+
 volatile atomic_bool needs_flush = false;
 
+// Trust database paths that changed since the last event. Past
+// MAX_PENDING paths, it's cheaper to throw away all objects.
+#define MAX_PENDING 4096
+static pthread_mutex_t pending_lock = PTHREAD_MUTEX_INITIALIZER;
+static char **pending = NULL;
+static unsigned int pending_cnt = 0, pending_size = 0;
+static int pending_overflow = 0;
+static atomic_bool needs_invalidate = false;
+
+// How much of a file is checked against the trust database
+static integrity_t integrity = IN_NONE;
+
+// The cache holds the subject of the process with this proc_info
+static int subject_match(const void *item, const void *id)
+{
+	return !compare_proc_infos(((const s_array *)item)->info, id);
+}
+
+// The cache holds the object of the file with this file_info
+static int object_match(const void *item, const void *id)
+{
+	return !compare_file_infos(((const o_array *)item)->info, id);
+}
+
+static void *entry_alloc(slab_t *slab)
+{
+	void *item;
+
+	pthread_mutex_lock(&slab_lock);
+	item = slab_alloc(slab);
+	pthread_mutex_unlock(&slab_lock);
+	return item;
+}
+
+static void entry_free(slab_t *slab, void *item)
+{
+	pthread_mutex_lock(&slab_lock);
+	slab_free(slab, item);
+	pthread_mutex_unlock(&slab_lock);
+}
+
+static void subject_release(void *item)
+{
+	subject_clear(item);
+	entry_free(&subj_slab, item);
+}
+
+static void object_release(void *item)
+{
+	object_clear(item);
+	entry_free(&obj_slab, item);
+}
+
+/*
+ * With a cache budget, the cache sizes are looked at every TUNE_INTERVAL
+ * seconds. A cache grows when enough misses hit its ghosts, the items it
+ * recently pushed out, and shrinks when most of it is unused. The subject
+ * cache is kept big enough for the running processes. If the sizes don't
+ * fit in the budget, both are scaled down.
+ */
+#define TUNE_INTERVAL 60
+#define TUNE_MIN_LOOKUPS 1000
+#define MIN_CACHE_SIZE 64
+static size_t cache_budget = 0;		// bytes, 0 means fixed sizes
+static time_t next_tune = 0;
+static int under_pressure = 0;
+static pthread_mutex_t tune_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Memory of a slot besides its item: the node, the way and the ghost
+#define SLOT_BYTES (sizeof(QNode) + sizeof(QNode *) + sizeof(unsigned int))
+
+struct cache_tune {
+	Queue **q;
+	size_t item;		// bytes of an empty item
+	size_t entry;		// bytes per slot
+	LStats last;		// metrics at the last look
+	unsigned int want;	// slots it should have
+	char why[80];
+};
+
+static struct cache_tune subj_tune = { &subj_cache, sizeof(s_array), 0,
+	{ 0 }, 0, "" };
+static struct cache_tune obj_tune = { &obj_cache, sizeof(o_array), 0,
+	{ 0 }, 0, "" };
+
+// The caches may not take more than this, 0 means no limit
+static size_t memory_limit = 0;
+
+// Decide the size a cache wants from what happened since the last look
+static void want_size(struct cache_tune *t)
+{
+	Queue *q = *t->q;
+	unsigned long lookups, ghosts;
+	LStats now;
+
+	// Items are measured as they are used
+	t->entry = (q->count ? lru_bytes(q) / q->count : t->item) +
+			SLOT_BYTES;
+	lru_stats(q, &now);
+	lookups = now.hits + now.misses - t->last.hits - t->last.misses;
+	ghosts = now.ghost_hits - t->last.ghost_hits;
+	t->last = now;
+	t->want = q->total;
+	t->why[0] = 0;
+	if (lookups < TUNE_MIN_LOOKUPS)
+		return;
+
+	// More than 1% of lookups would hit in a cache twice as big
+	if (ghosts * 100 >= lookups) {
+		t->want = q->total * 2;
+		snprintf(t->why, sizeof(t->why), "%lu of %lu lookups were ghosts",
+			 ghosts, lookups);
+	} else if (q->count < q->total / 4) {
+		t->want = q->count * 2;
+		snprintf(t->why, sizeof(t->why), "%u slots in use", q->count);
+	}
+}
+
+static void resize_cache(struct cache_tune *t)
+{
+	Queue *q = *t->q;
+	unsigned int old = q->total, ways = q->hash->ways;
+
+	if (t->want < MIN_CACHE_SIZE)
+		t->want = MIN_CACHE_SIZE;
+	// Only whole sets count
+	if ((t->want + ways - 1) / ways == (old + ways - 1) / ways)
+		return;
+	if (lru_resize(q, t->want)) {
+		msg(LOG_WARNING, "Cannot resize %s cache", q->name);
+		return;
+	}
+	msg(LOG_INFO, "Resized %s cache from %u to %u slots (%s)",
+	    q->name, old, q->total, t->why);
+}
+
+static void tune_caches(void)
+{
+	struct sysinfo si;
+	size_t need;
+
+	want_size(&subj_tune);
+	want_size(&obj_tune);
+
+	// Room for every process plus some that come and go
+	if (sysinfo(&si) == 0 &&
+			subj_tune.want < si.procs + si.procs / 4u) {
+		subj_tune.want = si.procs + si.procs / 4u;
+		snprintf(subj_tune.why, sizeof(subj_tune.why),
+			 "%u processes", si.procs);
+	}
+
+	need = subj_tune.want * subj_tune.entry +
+		obj_tune.want * obj_tune.entry;
+	if (need > cache_budget) {
+		double scale = (double)cache_budget / need;
+
+		subj_tune.want *= scale;
+		obj_tune.want *= scale;
+		snprintf(subj_tune.why, sizeof(subj_tune.why),
+			 "%zu KB over the budget", (need - cache_budget) / 1024);
+		strcpy(obj_tune.why, subj_tune.why);
+	}
+
+	resize_cache(&subj_tune);
+	resize_cache(&obj_tune);
+}
+
+// Look at the cache sizes if it's time to
+static void maybe_tune_caches(void)
+{
+	struct timespec now;
+
+	if (cache_budget == 0 || pthread_mutex_trylock(&tune_lock))
+		return;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	// Memory pressure decides the sizes until it is over
+	if (now.tv_sec >= next_tune && !under_pressure) {
+		next_tune = now.tv_sec + TUNE_INTERVAL;
+		tune_caches();
+	}
+	pthread_mutex_unlock(&tune_lock);
+}
+
+/*
+ * When the kernel reports memory pressure, the cache using more memory
+ * gives up half its slots each time. Once there has been no pressure for
+ * PRESSURE_CALM seconds, the caches double again every PRESSURE_CALM
+ * seconds until they are back to the size they had before.
+ */
+#define PRESSURE_CALM 30
+
+// Shrinks grow back to this many slots, 0 when not shrunk
+static unsigned int subj_full = 0, obj_full = 0;
+static time_t last_pressure = 0, last_growth = 0;
+static unsigned long pressure_events = 0, pressure_shrinks = 0;
+static unsigned long pressure_growths = 0;
+
+static int shrink_cache(struct cache_tune *t, unsigned int *full)
+{
+	Queue *q = *t->q;
+	unsigned int old = q->total;
+
+	if (old <= MIN_CACHE_SIZE)
+		return 1;
+	if (*full == 0)
+		*full = old;
+	t->want = old / 2;
+	strcpy(t->why, "memory pressure");
+	resize_cache(t);
+	if (q->total == old)
+		return 1;
+	pressure_shrinks++;
+	return 0;
+}
+
+static void grow_cache(struct cache_tune *t, unsigned int *full)
+{
+	Queue *q = *t->q;
+	unsigned int old = q->total;
+
+	if (*full == 0)
+		return;
+	t->want = old * 2 < *full ? old * 2 : *full;
+	strcpy(t->why, "memory pressure is over");
+	resize_cache(t);
+	if (q->total >= *full)
+		*full = 0;
+	if (q->total != old)
+		pressure_growths++;
+}
+
+// Called on every memory pressure event. The database snapshot and free
+// heap memory are given back too.
+void relieve_memory_pressure(void)
+{
+	Queue *big = lru_bytes(obj_cache) >= lru_bytes(subj_cache) ?
+			obj_cache : subj_cache;
+	struct timespec now;
+
+	pthread_mutex_lock(&tune_lock);
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	last_pressure = now.tv_sec;
+	pressure_events++;
+	under_pressure = 1;
+	if (big == obj_cache) {
+		if (shrink_cache(&obj_tune, &obj_full))
+			shrink_cache(&subj_tune, &subj_full);
+	} else if (shrink_cache(&subj_tune, &subj_full))
+		shrink_cache(&obj_tune, &obj_full);
+	pthread_mutex_unlock(&tune_lock);
+
+	database_release_snapshot();
+#ifdef HAVE_MALLOC_TRIM
+	malloc_trim(0);
+#endif
+}
+
+// Grow the caches back if the pressure is over. Returns the number of
+// milliseconds until it should be called again, or -1 when the caches
+// are back to their size.
+int recover_from_pressure(void)
+{
+	struct timespec now;
+	time_t next;
+	int rc = -1;
+
+	pthread_mutex_lock(&tune_lock);
+	if (!under_pressure)
+		goto out;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	next = (last_pressure > last_growth ? last_pressure : last_growth) +
+		PRESSURE_CALM;
+	if (now.tv_sec >= next) {
+		last_growth = now.tv_sec;
+		grow_cache(&subj_tune, &subj_full);
+		grow_cache(&obj_tune, &obj_full);
+		if (subj_full == 0 && obj_full == 0) {
+			under_pressure = 0;
+			goto out;
+		}
+		next = now.tv_sec + PRESSURE_CALM;
+	}
+	rc = (next - now.tv_sec) * 1000;
+out:
+	pthread_mutex_unlock(&tune_lock);
+	return rc;
+}
+
 // Return 0 on success and 1 on error
 int init_event_system(const conf_t *config)
 {
-	subj_cache=init_lru(config->subj_cache_size,
-				(void (*)(void *))subject_clear, "Subject");
+	slab_init(&subj_slab, sizeof(s_array), 64);
+	slab_init(&obj_slab, sizeof(o_array), 64);
+
+	subj_cache=init_lru(config->subj_cache_size, config->cache_policy,
+				subject_release, subject_match, "Subject");
 	if (!subj_cache)
 		return 1;
 
-	obj_cache = init_lru(config->obj_cache_size,
-				(void (*)(void *))object_clear, "Object");
+	obj_cache = init_lru(config->obj_cache_size, config->cache_policy,
+				object_release, object_match, "Object");
 	if (!obj_cache)
 		return 1;
 
+	cache_budget = (size_t)config->cache_budget * 1024 * 1024;
+	memory_limit = (size_t)config->cache_memory_limit * 1024 * 1024;
+	integrity = config->integrity;
+
 	return 0;
 }
 
-static int flush_cache(void)
+// Objects in use by other decisions go away when they are released
+static void flush_cache(void)
 {
 	if (obj_cache->count == 0)
-		return 0;
-
-	const unsigned int size = obj_cache->total;
+		return;
 
 	msg(LOG_DEBUG, "Flushing object cache");
-	destroy_lru(obj_cache);
+	lru_flush(obj_cache);
+	msg(LOG_DEBUG, "Flushed");
+}
 
-	obj_cache = init_lru(size,
-				(void (*)(void *))object_clear, "Object");
-	if (!obj_cache)
+/*
+ * Record that the trust of path changed. The cached objects of the file
+ * and the trust of subjects running it are dropped before the next
+ * event. This is called by the thread that updates the database.
+ */
+void invalidate_trust_path(const char *path)
+{
+	char buf[PATH_MAX+1];
+
+	path = trust_db_path(path, buf, sizeof(buf));
+
+	pthread_mutex_lock(&pending_lock);
+	if (pending_overflow)
+		goto out;
+	if (pending_cnt == MAX_PENDING) {
+		pending_overflow = 1;
+		goto out;
+	}
+	if (pending_cnt == pending_size) {
+		unsigned int size = pending_size ? pending_size * 2 : 64;
+		char **tmp = realloc(pending, size * sizeof(char *));
+
+		if (tmp == NULL) {
+			pending_overflow = 1;
+			goto out;
+		}
+		pending = tmp;
+		pending_size = size;
+	}
+	pending[pending_cnt] = strdup(path);
+	if (pending[pending_cnt] == NULL)
+		pending_overflow = 1;
+	else
+		pending_cnt++;
+out:
+	needs_invalidate = true;
+	pthread_mutex_unlock(&pending_lock);
+}
+
+struct changed_paths {
+	char **paths;	// sorted, NULL means every path changed
+	unsigned int cnt;
+};
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+static int path_changed(const struct changed_paths *c, const char *path)
+{
+	char buf[PATH_MAX+1];
+
+	if (c->paths == NULL)
 		return 1;
+	if (path == NULL)
+		return 0;
+	path = trust_db_path(path, buf, sizeof(buf));
+	return bsearch(&path, c->paths, c->cnt, sizeof(char *),
+		       compare_paths) != NULL;
+}
 
-	msg(LOG_DEBUG, "Flushed");
+// Objects of changed files have to be looked up again
+static int object_changed(void *item, void *arg)
+{
+	object_attr_t *on = object_find_file(item);
+
+	return on && path_changed(arg, on->o);
+}
+
+// Subjects keep their state, only the trust of the exe is looked up again
+static int subject_changed(void *item, void *arg)
+{
+	subject_attr_t *sn = subject_find_exe(item);
 
+	if (sn && path_changed(arg, sn->str))
+		subject_reset(item, SUBJ_TRUST);
 	return 0;
 }
 
+// Drop what depends on the trust of the paths that changed
+static void invalidate_caches(void)
+{
+	struct changed_paths c;
+	unsigned int i, cnt;
+	int overflow;
+
+	pthread_mutex_lock(&pending_lock);
+	c.paths = pending;
+	c.cnt = pending_cnt;
+	overflow = pending_overflow;
+	pending = NULL;
+	pending_cnt = pending_size = 0;
+	pending_overflow = 0;
+	needs_invalidate = false;
+	pthread_mutex_unlock(&pending_lock);
+
+	if (overflow) {
+		for (i = 0; i < c.cnt; i++)
+			free(c.paths[i]);
+		free(c.paths);
+		c.paths = NULL;
+		flush_cache();
+		lru_prune(subj_cache, subject_changed, &c);
+		return;
+	}
+
+	if (c.cnt == 0)
+		return;
+
+	qsort(c.paths, c.cnt, sizeof(char *), compare_paths);
+	cnt = lru_prune(obj_cache, object_changed, &c);
+	lru_prune(subj_cache, subject_changed, &c);
+	msg(LOG_DEBUG, "%u trust changes invalidated %u objects", c.cnt, cnt);
+
+	for (i = 0; i < c.cnt; i++)
+		free(c.paths[i]);
+	free(c.paths);
+}
+
 void destroy_event_system(void)
 {
+	unsigned int i;
+
+	for (i = 0; i < pending_cnt; i++)
+		free(pending[i]);
+	free(pending);
+	pending = NULL;
+	pending_cnt = pending_size = 0;
+
 	destroy_lru(subj_cache);
 	destroy_lru(obj_cache);
+	slab_destroy(&subj_slab);
+	slab_destroy(&obj_slab);
+}
+
+// Returns 1 if the change time of the file is the one in the snapshot
+static int restored_object_valid(o_array *o, int fd)
+{
+	struct stat sb;
+
+	if (fstat(fd, &sb) || sb.st_ctim.tv_sec != o->ctime.tv_sec ||
+			sb.st_ctim.tv_nsec != o->ctime.tv_nsec)
+		return 0;
+	o->restored = 0;
+	return 1;
 }
 
 // Return 0 on success and 1 on error
@@ -97,31 +540,37 @@ int new_event(const struct fanotify_event_metadata *m, event_t *e)
 	unsigned int key, rc, evict = 1, skip_path = 0;
 	s_array *s;
 	o_array *o;
-	struct proc_info *pinfo;
-	struct file_info *finfo;
+	struct proc_info proc, *pinfo;
+	struct file_info file;
 
-	if (needs_flush) {
+	if (atomic_exchange(&needs_flush, false))
 		flush_cache();
-		needs_flush = false;
-	}
+	if (needs_invalidate)
+		invalidate_caches();
+	maybe_tune_caches();
 
 	// Transfer things from fanotify structs to ours
 	e->pid = m->pid;
 	e->fd = m->fd;
 	e->type = m->mask & ALL_EVENTS;
-
-	key = compute_subject_key(subj_cache, m->pid);
-	q_node = check_lru_cache(subj_cache, key);
-	s = (s_array *)q_node->item;
+	e->s_node = NULL;
+	e->o_node = NULL;
 
 	// get proc fingerprint
-	pinfo = stat_proc_entry(m->pid);
-	if (pinfo == NULL)
+	if (stat_proc_entry(m->pid, &proc))
+		return 1;
+
+	// Only a subject with the same fingerprint is found
+	key = compute_subject_key(proc.pid, &proc.time);
+	q_node = check_lru_cache(subj_cache, key, &proc);
+	if (q_node == NULL)
 		return 1;
+	e->s_node = q_node;
+	s = (s_array *)q_node->item;
 
 	// Check the subject to see if its what its supposed to be
 	if (s) {
-		rc = compare_proc_infos(pinfo, s->info);
+		rc = 0;
 
 		// EXEC_PERM causes 2 events for every execute. First is an
 		// execute request. This is followed by an open request of
@@ -171,8 +620,11 @@ int new_event(const struct fanotify_event_metadata *m, event_t *e)
 		}
 
 		if (evict) {
-			lru_evict(subj_cache, key);
-			q_node = check_lru_cache(subj_cache, key);
+			lru_evict(subj_cache, q_node);
+			q_node = check_lru_cache(subj_cache, key, &proc);
+			e->s_node = q_node;
+			if (q_node == NULL)
+				return 1;
 			s = (s_array *)q_node->item;
 		} else if (s->cnt == 0)
 			msg(LOG_DEBUG, "cached subject has cnt of 0");
@@ -180,78 +632,84 @@ int new_event(const struct fanotify_event_metadata *m, event_t *e)
 
 	if (evict) {
 		// If empty, setup the subject with what we currently have
-		e->s = malloc(sizeof(s_array));
+		e->s = entry_alloc(&subj_slab);
+		if (e->s == NULL)
+			goto err;
 		subject_create(e->s);
+		*e->s->info = proc;
 		subj.type = PID;
 		subj.val = e->pid;
 		subject_add(e->s, &subj);
 
 		// give custody of the list to the cache
-		q_node->item = e->s;
-		((s_array *)q_node->item)->info = pinfo;
+		lru_set_item(subj_cache, q_node, e->s);
 
 		// If this is the first time we've seen this process
 		// and its doing a file open, its likely to be a running
 		// process. That means we should not do pattern detection.
 		if (!s && (e->type & FAN_OPEN_PERM))
-			pinfo->state = STATE_NORMAL;
-	} else	{ // Use the one from the cache
+			e->s->info->state = STATE_NORMAL;
+	} else	// Use the one from the cache
 		e->s = s;
-		clear_proc_info(pinfo);
-		free(pinfo);
-	}
 
 	// Init the object
 	// get file fingerprint
 	rc = 1;
-	finfo = stat_file_entry(m->fd);
-	if (finfo == NULL)
-		return 1;
-
-	// Just using inodes don't give a good key. It needs
-	// conditioning to use more slots in the cache.
-	unsigned long magic = finfo->inode + finfo->time.tv_nsec + finfo->size;
-	key = compute_object_key(obj_cache, magic);
-	q_node = check_lru_cache(obj_cache, key);
+	if (stat_file_entry(m->fd, &file))
+		goto err;
+
+	// Only an object with the same fingerprint is found. A file
+	// that changed gets a new entry and the old one ages out.
+	key = compute_object_key(file.device, file.inode, &file.time,
+				 file.size);
+	q_node = check_lru_cache(obj_cache, key, &file);
+	if (q_node == NULL)
+		goto err;
+	e->o_node = q_node;
 	o = (o_array *)q_node->item;
 
-	if (o) {
-		rc = compare_file_infos(finfo, o->info);
-		if (rc) {
-			lru_evict(obj_cache, key);
-			q_node = check_lru_cache(obj_cache, key);
-			o = (o_array *)q_node->item;
-		}
+	// An object from the snapshot is only used if the file didn't
+	// change at all since the snapshot was taken
+	if (o && o->restored && !restored_object_valid(o, m->fd)) {
+		lru_evict(obj_cache, q_node);
+		e->o_node = NULL;
+		q_node = check_lru_cache(obj_cache, key, &file);
+		if (q_node == NULL)
+			goto err;
+		e->o_node = q_node;
+		o = (o_array *)q_node->item;
 	}
+	if (o)
+		rc = 0;
 
 	if (rc) {
 		// If empty, setup the object with what we currently have
-		e->o = malloc(sizeof(o_array));
+		e->o = entry_alloc(&obj_slab);
+		if (e->o == NULL)
+			goto err;
 		object_create(e->o);
+		*e->o->info = file;
 
 		// give custody of the list to the cache
-		q_node->item = e->o;
-		((o_array *)q_node->item)->info = finfo;
-	} else { // Use the one from the cache
+		lru_set_item(obj_cache, q_node, e->o);
+	} else // Use the one from the cache
 		e->o = o;
-		free(finfo);
-	}
 
 	// Setup pattern info
 	pinfo = e->s->info;
 	if (pinfo && !skip_path && pinfo->state < STATE_FULL) {
 		object_attr_t *on = get_obj_attr(e, PATH);
 		if (on) {
-			const char *file = on->o;
+			const char *path = on->o;
 			if (pinfo->path1 == NULL) {
 				// In this step, we gather info on what is
 				// being asked permission to execute.
-				pinfo->path1 = strdup(file);
+				pinfo->path1 = intern_ref(path);
 				pinfo->elf_info = gather_elf(e->fd,
 							e->o->info->size);
 			//	pinfo->state = STATE_COLLECTING;Just for clarity
 			} else if (pinfo->path2 == NULL) {
-				pinfo->path2 = strdup(file);
+				pinfo->path2 = intern_ref(path);
 				pinfo->state = STATE_PARTIAL;
 			} else {
 				// This third look is needed because the first
@@ -267,6 +725,48 @@ int new_event(const struct fanotify_event_metadata *m, event_t *e)
 		} 
 	}
 	return 0;
+err:
+	release_event(e);
+	return 1;
+}
+
+// Push out the oldest entries until the caches fit in the memory limit.
+// The cache taking more memory gives up its entries first.
+static void enforce_memory_limit(void)
+{
+	size_t sbytes = lru_bytes(subj_cache), obytes = lru_bytes(obj_cache);
+	Queue *big = obytes >= sbytes ? obj_cache : subj_cache;
+	Queue *small = big == obj_cache ? subj_cache : obj_cache;
+	size_t small_bytes = big == obj_cache ? sbytes : obytes, big_bytes;
+
+	if (sbytes + obytes <= memory_limit)
+		return;
+
+	lru_trim(big, memory_limit > small_bytes ?
+			memory_limit - small_bytes : 0);
+	big_bytes = lru_bytes(big);
+	if (big_bytes + small_bytes > memory_limit)
+		lru_trim(small, memory_limit > big_bytes ?
+				memory_limit - big_bytes : 0);
+}
+
+// Let the cache free the subject and object once nobody uses them
+void release_event(event_t *e)
+{
+	// The rules have looked up what they need, so count it now
+	if (e->s_node && e->s_node->item)
+		lru_set_bytes(subj_cache, e->s_node,
+			      subject_bytes(e->s_node->item));
+	if (e->o_node && e->o_node->item)
+		lru_set_bytes(obj_cache, e->o_node,
+			      object_bytes(e->o_node->item));
+	lru_release(subj_cache, e->s_node);
+	lru_release(obj_cache, e->o_node);
+	e->s_node = NULL;
+	e->o_node = NULL;
+
+	if (memory_limit)
+		enforce_memory_limit();
 }
 
 /*
@@ -306,9 +806,9 @@ subject_attr_t *get_subj_attr(event_t *e, subject_type_t t)
 			char buf[21], *ptr;
 			ptr = get_comm_from_pid(e->pid,	sizeof(buf), buf);
 			if (ptr)
-				subj.str = strdup(buf);
+				subj.str = intern(buf);
 			else
-				subj.str = strdup("?");
+				subj.str = intern("?");
 			}
 			break;
 		// If these 2 ever get separated, update subject_add
@@ -319,23 +819,23 @@ subject_attr_t *get_subj_attr(event_t *e, subject_type_t t)
 			ptr = get_program_from_pid(e->pid,
 						sizeof(buf), buf);
 			if (ptr)
-				subj.str = strdup(buf);
+				subj.str = intern(buf);
 			else
-				subj.str = strdup("?");
+				subj.str = intern("?");
 			}
 			break;
 		case EXE_TYPE: {
 			char buf[128], *ptr;
 			ptr = get_type_from_pid(e->pid, sizeof(buf), buf);
 			if (ptr)
-				subj.str = strdup(buf);
+				subj.str = intern(buf);
 			else
-				subj.str = strdup("?");
+				subj.str = intern("?");
 			}
 			break;
 		case EXE_DEVICE:
 			// FIXME: write real code for this
-			subj.str = strdup("?");
+			subj.str = intern("?");
 			break;
 		case SUBJ_TRUST: {
 			subject_attr_t *exe = get_subj_attr(e, EXE);
@@ -363,12 +863,12 @@ subject_attr_t *get_subj_attr(event_t *e, subject_type_t t)
 		return sn;
 	}
 
-	// free .str/set only when it was really used
-	// otherwise invalid free is possible
+	// free the set only when it was really used, otherwise invalid
+	// free is possible.
 	if (t == GID)
 		destroy_attr_set(subj.set);
 	else if (t >= COMM)
-		free(subj.str);
+		intern_release(subj.str);
 	return NULL;
 }
 
@@ -397,24 +897,24 @@ object_attr_t *get_obj_attr(event_t *e, object_type_t t)
 		case ODIR:
 			// Try to avoid looking up the path if we have it
 			on = object_find_file(o);
-			if (on)
-				obj.o = strdup(on->o);
+			if (on)	// Both hold the same interned string
+				obj.o = intern_ref(on->o);
 			else {
 				ptr = get_file_from_fd(e->fd, e->pid,
 							sizeof(buf), buf);
 				if (ptr)
-					obj.o = strdup(buf);
+					obj.o = intern(buf);
 				else
-					obj.o = strdup("?");
+					obj.o = intern("?");
 			}
 			break;
 		case DEVICE:
 			ptr = get_device_from_stat(o->info->device,
 					sizeof(buf), buf);
 			if (ptr)
-				obj.o = strdup(buf);
+				obj.o = intern(buf);
 			else
-				obj.o = strdup("?");
+				obj.o = intern("?");
 			break;
 		case FTYPE: {
 			object_attr_t *path =  get_obj_attr(e, PATH);
@@ -422,13 +922,17 @@ object_attr_t *get_obj_attr(event_t *e, object_type_t t)
 							path ? path->o : "?",
 							sizeof(buf), buf);
 			if (ptr)
-				obj.o = strdup(buf);
+				obj.o = intern(buf);
 			else
-				obj.o = strdup("?");
+				obj.o = intern("?");
 			}
 			break;
 		case SHA256HASH:
-			obj.o = get_hash_from_fd(e->fd);
+			ptr = get_hash_from_fd(e->fd);
+			if (ptr) {
+				obj.o = intern(ptr);
+				free(ptr);
+			}
 			break;
 		case OBJ_TRUST: {
 			object_attr_t *path =  get_obj_attr(e, PATH);
@@ -455,19 +959,126 @@ object_attr_t *get_obj_attr(event_t *e, object_type_t t)
 		return on;
 	}
 
-	free(obj.o);
+	intern_release(obj.o);
 	return NULL;
 }
 
-static void print_queue_stats(FILE *f, const Queue *q)
+static void print_queue_stats(FILE *f, Queue *q)
 {
+	LStats st;
+
+	lru_stats(q, &st);
 	fprintf(f, "%s cache size: %u\n", q->name, q->total);
 	fprintf(f, "%s slots in use: %u (%u%%)\n", q->name, q->count,
 				q->total ? (100*q->count)/q->total : 0);
-	fprintf(f, "%s hits: %lu\n", q->name, q->hits);
-	fprintf(f, "%s misses: %lu\n", q->name, q->misses);
-	fprintf(f, "%s evictions: %lu (%lu%%)\n", q->name, q->evictions,
-				q->hits ? (100*q->evictions)/q->hits : 0);
+	fprintf(f, "%s hits: %lu\n", q->name, st.hits);
+	fprintf(f, "%s misses: %lu\n", q->name, st.misses);
+	fprintf(f, "%s collisions: %lu (%lu%%)\n", q->name, st.collisions,
+				st.misses ? (100*st.collisions)/st.misses : 0);
+	fprintf(f, "%s stale: %lu (%lu%%)\n", q->name, st.stale,
+				st.hits ? (100*st.stale)/st.hits : 0);
+	fprintf(f, "%s policy: %s\n", q->name, lru_policy_name(q->policy));
+	fprintf(f, "%s hit rate: %lu%%\n", q->name, st.hits + st.misses ?
+			(100*st.hits)/(st.hits + st.misses) : 0);
+	if (q->policy == POLICY_CLOCK)
+		fprintf(f, "%s second chances: %lu\n", q->name,
+				st.second_chances);
+	else if (q->policy == POLICY_2Q) {
+		fprintf(f, "%s promotions: %lu\n", q->name, st.promotions);
+		fprintf(f, "%s protected hits: %lu (%lu%%)\n", q->name,
+				st.protected_hits, st.hits ?
+				(100*st.protected_hits)/st.hits : 0);
+	}
+	fprintf(f, "%s ghost hits: %lu (%lu%%)\n", q->name, st.ghost_hits,
+				st.misses ? (100*st.ghost_hits)/st.misses : 0);
+}
+
+static void print_bytes(FILE *f, const char *name, const char *what,
+		size_t bytes, unsigned int cnt)
+{
+	fprintf(f, "%s memory %s: %zu bytes", name, what, bytes);
+	if (cnt)
+		fprintf(f, " (%zu per entry)", bytes / cnt);
+	fputc('\n', f);
+}
+
+static size_t string_bytes(const char *str)
+{
+	return str ? strlen(str) + 1 : 0;
+}
+
+/*
+ * Show where the memory of the caches goes. Entries are the items with
+ * their share of the interned strings and their sets, which is what
+ * cache_memory_limit applies to. The attribute lines are the lengths of
+ * the strings the entries refer to, as if each had its own copy.
+ */
+static void print_object_memory(FILE *f, Queue *q)
+{
+	size_t attr[OBJ_NUM] = { 0 };
+	unsigned int i;
+	QNode *q_node;
+
+	for (q_node = q->front; q_node; q_node = q_node->next) {
+		const o_array *o = q_node->item;
+
+		if (o == NULL)
+			continue;
+		for (i = 0; i < OBJ_NUM; i++) {
+			const object_attr_t *on = o->obj[i];
+
+			// The path and dir share their string
+			if (on == NULL || (i == ODIR - OBJ_START &&
+					o->obj[PATH - OBJ_START]))
+				continue;
+			attr[i] += string_bytes(on->o);
+		}
+	}
+
+	print_bytes(f, q->name, "entries", lru_bytes(q), q->count);
+	print_bytes(f, q->name, "slots", lru_fixed_bytes(q), 0);
+	for (i = 0; i < OBJ_NUM; i++)
+		if (attr[i])
+			print_bytes(f, q->name, obj_val_to_name(i + OBJ_START),
+				    attr[i], 0);
+}
+
+static void print_subject_memory(FILE *f, Queue *q)
+{
+	size_t attr[SUBJ_NUM] = { 0 }, paths = 0;
+	unsigned int i;
+	QNode *q_node;
+
+	for (q_node = q->front; q_node; q_node = q_node->next) {
+		const s_array *s = q_node->item;
+
+		if (s == NULL)
+			continue;
+		paths += string_bytes(s->info->path1) +
+			 string_bytes(s->info->path2);
+		for (i = 0; i < SUBJ_NUM; i++) {
+			const subject_attr_t *sn = s->subj[i];
+
+			if (sn == NULL)
+				continue;
+			if (sn->type == GID)
+				attr[i] += attr_set_bytes(sn->set);
+			// The exe and its dir share their string
+			else if (sn->type >= COMM && !(sn->type == EXE_DIR &&
+					s->subj[EXE - SUBJ_START]))
+				attr[i] += string_bytes(sn->str);
+		}
+	}
+
+	print_bytes(f, q->name, "entries", lru_bytes(q), q->count);
+	print_bytes(f, q->name, "slots", lru_fixed_bytes(q), 0);
+	if (paths)
+		print_bytes(f, q->name, "pattern paths", paths, 0);
+	for (i = 0; i < SUBJ_NUM; i++)
+		if (attr[i])
+			print_bytes(f, q->name,
+				    subj_val_to_name(i + SUBJ_START, RULE_FMT_ORIG),
+				    attr[i], 0);
 }
 
 void run_usage_report(const conf_t *config, FILE *f)
@@ -517,6 +1128,7 @@ void run_usage_report(const conf_t *config, FILE *f)
 		fprintf(f, "\n---\n\n");
 	}
 	print_queue_stats(f, obj_cache);
+	print_object_memory(f, obj_cache);
 	fprintf(f, "\n\n");
 
 	if (config->detailed_report) {
@@ -536,7 +1148,8 @@ void run_usage_report(const conf_t *config, FILE *f)
 
 		while (q_node) {
 			unsigned int len;
-			char *exe, *comm, *text;
+			const char *exe, *comm;
+			char *text;
 			subject_attr_t *se, *sc;
 			s_array *s = (s_array *)q_node->item;
 			se = subject_find_exe(s);
@@ -569,6 +1182,269 @@ void run_usage_report(const conf_t *config, FILE *f)
 		fprintf(f, "\n---\n\n");
 	}
 	print_queue_stats(f, subj_cache);
+	print_subject_memory(f, subj_cache);
+	intern_report(f);
 	fprintf(f, "\n");
+
+	pthread_mutex_lock(&tune_lock);
+	fprintf(f, "Memory pressure events: %lu\n", pressure_events);
+	fprintf(f, "Cache shrinks: %lu\n", pressure_shrinks);
+	fprintf(f, "Cache growths: %lu\n", pressure_growths);
+	pthread_mutex_unlock(&tune_lock);
+}
+
+
+/*
+ * The snapshot keeps what is costly to learn about the objects that were
+ * used more than once: file type, hash and trust. Each line is
+ *   dev inode mode size mtime ctime trust ftype sha256 path
+ * The trust is only used if the database stamps and the integrity mode
+ * are the same as when the snapshot was saved. A missing value is
+ * written as -.
+ */
+#define SNAPSHOT_HEADER "# fapolicyd object cache 1\n"
+
+/*
+ * Reduce the database stamps and the integrity mode to a number for the
+ * snapshot header. Trust found with a weaker integrity check must not be
+ * used after a stronger one is configured. It returns 0 without stamps.
+ */
+unsigned long long snapshot_digest(const char *stamps, integrity_t mode)
+{
+	unsigned long long h = 0xcbf29ce484222325ULL;
+	const char *p;
+
+	if (stamps == NULL)
+		return 0;
+	for (p = stamps; *p; p++)
+		h = (h ^ (unsigned char)*p) * 0x100000001b3ULL;
+	h = (h ^ (unsigned int)mode) * 0x100000001b3ULL;
+	return h ? h : 1;
+}
+
+static unsigned long long stamps_digest(void)
+{
+	char stamps[STAMP_SIZE];
+
+	if (database_stamps(stamps, sizeof(stamps)))
+		return 0;
+	return snapshot_digest(stamps, integrity);
 }
 
+static const char *snapshot_string(const o_array *o, object_type_t t)
+{
+	const object_attr_t *on = object_access(o, t);
+
+	// The fields are separated by blanks
+	if (on == NULL || on->o == NULL || on->o[0] == 0 ||
+			strpbrk(on->o, " \t\n"))
+		return "-";
+	return on->o;
+}
+
+static void save_object(FILE *f, const QNode *q_node)
+{
+	const o_array *o = q_node->item;
+	const object_attr_t *path, *trust;
+	struct file_info now;
+	struct stat sb;
+	int fd;
+
+	if (o == NULL || q_node->uses < 2)
+		return;
+	path = object_access(o, PATH);
+	if (path == NULL || path->o == NULL || path->o[0] != '/' ||
+			strchr(path->o, '\n'))
+		return;
+	if (object_access(o, FTYPE) == NULL &&
+			object_access(o, SHA256HASH) == NULL)
+		return;
+
+	// Only save it if the file is still what was cached
+	fd = open(path->o, O_PATH|O_CLOEXEC);
+	if (fd < 0)
+		return;
+	if (stat_file_entry(fd, &now) || compare_file_infos(&now, o->info) ||
+			fstat(fd, &sb)) {
+		close(fd);
+		return;
+	}
+	close(fd);
+
+	trust = object_access(o, OBJ_TRUST);
+	fprintf(f, "%llu %llu %o %lld %lld.%09ld %lld.%09ld %s %s %s %s\n",
+		(unsigned long long)now.device,
+		(unsigned long long)now.inode, (unsigned int)now.mode,
+		(long long)now.size,
+		(long long)now.time.tv_sec, now.time.tv_nsec,
+		(long long)sb.st_ctim.tv_sec, sb.st_ctim.tv_nsec,
+		trust ? (trust->val ? "1" : "0") : "-",
+		snapshot_string(o, FTYPE), snapshot_string(o, SHA256HASH),
+		path->o);
+}
+
+// Save the objects used more than once. Returns 0 on success.
+int save_object_snapshot(const char *file)
+{
+	char tmp[PATH_MAX];
+	QNode *q_node;
+	FILE *f;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >= (int)sizeof(tmp))
+		return 1;
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0) {
+		msg(LOG_WARNING, "Cannot save object cache %s (%s)", file,
+		    strerror(errno));
+		return 1;
+	}
+	f = fdopen(fd, "w");
+	if (f == NULL) {
+		close(fd);
+		unlink(tmp);
+		return 1;
+	}
+
+	fputs(SNAPSHOT_HEADER, f);
+	fprintf(f, "stamps %016llx\n", stamps_digest());
+	for (q_node = obj_cache->front; q_node; q_node = q_node->next)
+		save_object(f, q_node);
+
+	if (fflush(f) || fsync(fileno(f)) || ferror(f)) {
+		fclose(f);
+		unlink(tmp);
+		return 1;
+	}
+	fclose(f);
+
+	if (rename(tmp, file)) {
+		unlink(tmp);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int add_string(o_array *o, object_type_t t, const char *str)
+{
+	object_attr_t obj;
+
+	if (strcmp(str, "-") == 0)
+		return 0;
+	obj.type = t;
+	obj.val = 0;
+	obj.o = intern(str);
+	if (obj.o == NULL)
+		return 1;
+	if (object_add(o, &obj)) {
+		intern_release(obj.o);
+		return 1;
+	}
+	return 0;
+}
+
+// Put an object from the snapshot into the cache
+static void restore_object(const struct file_info *file,
+		const struct timespec *ctime, int trust, const char *ftype,
+		const char *sha, const char *path)
+{
+	unsigned int key = compute_object_key(file->device, file->inode,
+					      &file->time, file->size);
+	QNode *q_node = check_lru_cache(obj_cache, key, file);
+	o_array *o;
+
+	if (q_node == NULL)
+		return;
+	if (q_node->item)
+		goto out;
+
+	o = entry_alloc(&obj_slab);
+	if (o == NULL)
+		goto out;
+	object_create(o);
+	*o->info = *file;
+	o->ctime = *ctime;
+	o->restored = 1;
+	if (add_string(o, PATH, path) || add_string(o, FTYPE, ftype) ||
+			add_string(o, SHA256HASH, sha)) {
+		object_release(o);
+		goto out;
+	}
+	if (trust >= 0) {
+		object_attr_t obj;
+
+		obj.type = OBJ_TRUST;
+		obj.val = trust;
+		obj.o = NULL;
+		object_add(o, &obj);
+	}
+	lru_set_item(obj_cache, q_node, o);
+	lru_set_bytes(obj_cache, q_node, object_bytes(o));
+out:
+	lru_release(obj_cache, q_node);
+}
+
+// Load the objects of a snapshot. Returns 0 on success.
+int load_object_snapshot(const char *file)
+{
+	char buf[PATH_MAX + 512];
+	unsigned long long stamps = 0;
+	unsigned int cnt = 0;
+	int use_trust;
+	FILE *f = fopen(file, "re");
+
+	if (f == NULL)
+		return errno == ENOENT ? 0 : 1;
+
+	if (fgets(buf, sizeof(buf), f) == NULL ||
+	    strcmp(buf, SNAPSHOT_HEADER) ||
+	    fgets(buf, sizeof(buf), f) == NULL ||
+	    sscanf(buf, "stamps %llx", &stamps) != 1) {
+		// Unknown format, start over
+		fclose(f);
+		return 0;
+	}
+	use_trust = stamps && stamps == stamps_digest();
+
+	while (fgets(buf, sizeof(buf), f) && cnt < obj_cache->total) {
+		unsigned long long dev, ino;
+		unsigned int mode;
+		long long size, msec, csec;
+		long mnsec, cnsec;
+		char trust[2], ftype[256], sha[65];
+		struct file_info info;
+		struct timespec ctime;
+		int path = 0;
+
+		if (sscanf(buf, "%llu %llu %o %lld %lld.%ld %lld.%ld %1s "
+			   "%255s %64s %n", &dev, &ino, &mode, &size, &msec,
+			   &mnsec, &csec, &cnsec, trust, ftype, sha,
+			   &path) != 11 ||
+		    path == 0 || buf[path] != '/')
+			continue;
+		buf[strcspn(buf, "\n")] = 0;
+
+		memset(&info, 0, sizeof(info));
+		info.device = dev;
+		info.inode = ino;
+		info.mode = mode;
+		info.size = size;
+		info.time.tv_sec = msec;
+		info.time.tv_nsec = mnsec;
+		ctime.tv_sec = csec;
+		ctime.tv_nsec = cnsec;
+		restore_object(&info, &ctime,
+			       use_trust && trust[0] != '-' ?
+					trust[0] == '1' : -1,
+			       ftype, sha, &buf[path]);
+		cnt++;
+	}
+	fclose(f);
+	if (memory_limit)
+		enforce_memory_limit();
+	msg(LOG_DEBUG, "Restored %u objects%s", cnt,
+	    use_trust ? "" : " without trust");
+
+	return 0;
+}
@@ -32,6 +32,9 @@
 #include "subject.h"
 #include "object.h"
 #include "conf.h"
+#include "lru.h"
+
+#define OBJ_SNAPSHOT_PATH "/var/lib/fapolicyd/object-cache.snapshot"
 
 typedef struct ev {
 	pid_t pid;
@@ -39,13 +42,22 @@ typedef struct ev {
 	int type;
 	s_array *s;
 	o_array *o;
+	QNode *s_node;	// keeps s in memory until release_event
+	QNode *o_node;	// keeps o in memory until release_event
 } event_t;
 
 int init_event_system(const conf_t *config);
 void destroy_event_system(void);
 int new_event(const struct fanotify_event_metadata *m, event_t *e);
+void release_event(event_t *e);
+void invalidate_trust_path(const char *path);
 subject_attr_t *get_subj_attr(event_t *e, subject_type_t t);
 object_attr_t *get_obj_attr(event_t *e, object_type_t t);
+void relieve_memory_pressure(void);
+int recover_from_pressure(void);
 void run_usage_report(const conf_t *config, FILE *f);
+int save_object_snapshot(const char *file);
+int load_object_snapshot(const char *file);
+unsigned long long snapshot_digest(const char *stamps, integrity_t mode);
 
 #endif
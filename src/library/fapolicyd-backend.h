@@ -32,13 +32,27 @@ typedef enum { SRC_UNKNOWN, SRC_RPM, SRC_FILE_DB } trust_src_t;
 // source, size, sha
 #define DATA_FORMAT "%u %lu %64s"
 
+// Running digest of the metadata of the files a backend loads from
+typedef struct _backend_stamp
+{
+	unsigned long long digest;
+	unsigned long files;
+} backend_stamp;
+
 typedef struct _backend
 {
 	const char * name;
 	int (*init)(void);
 	int (*load)(void);
 	int (*close)(void);
+	// Optional, fills in a stamp that changes whenever the source does
+	int (*stamp)(backend_stamp *st);
+	// Optional, loads only what a package transaction changed
+	int (*load_changes)(list_t *packages, list_t *paths);
 	list_t list;
 } backend;
 
+void stamp_path(backend_stamp *st, const char *path);
+void stamp_dir(backend_stamp *st, const char *path);
+
 #endif
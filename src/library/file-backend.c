@@ -38,6 +38,7 @@
 static int file_init_backend(void);
 static int file_load_list(void);
 static int file_destroy_backend(void);
+static int file_stamp(backend_stamp *st);
 
 backend file_backend =
 {
@@ -45,6 +46,8 @@ backend file_backend =
 	file_init_backend,
 	file_load_list,
 	file_destroy_backend,
+	file_stamp,
+	NULL,
 	{ 0, 0, NULL },
 };
 
@@ -58,6 +61,14 @@ static int file_load_list(void)
 	return 0;
 }
 
+// The trust file and everything in the trust.d directory
+static int file_stamp(backend_stamp *st)
+{
+	stamp_path(st, TRUST_FILE_PATH);
+	stamp_dir(st, TRUST_DIR_PATH);
+	return 0;
+}
+
 static int file_init_backend(void)
 {
 	list_init(&file_backend.list);
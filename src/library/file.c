@@ -102,15 +102,12 @@ void file_close(void)
 }
 
 
-struct file_info *stat_file_entry(int fd)
+// Fill in the fingerprint of a file. Returns 0 on success, 1 on error.
+int stat_file_entry(int fd, struct file_info *info)
 {
 	struct stat sb;
 
 	if (fstat(fd, &sb) == 0) {
-		struct file_info *info = malloc(sizeof(struct file_info));
-		if (info == NULL)
-			return info;
-
 		info->device = sb.st_dev;
 		info->inode = sb.st_ino;
 		info->mode = sb.st_mode;
@@ -127,9 +124,9 @@ struct file_info *stat_file_entry(int fd)
 			info->time.tv_nsec = sb.st_mtim.tv_nsec;
 		else
 			info->time.tv_nsec = sb.st_ctim.tv_nsec;
-		return info;
+		return 0;
 	}
-	return NULL;
+	return 1;
 }
 
 
@@ -397,6 +394,9 @@ char *bytes2hex(char *final, const char *buf, unsigned int size)
 }
 
 
+// Large reads keep the number of syscalls down on big files
+#define HASH_READ_SIZE (64*1024)
+
 // This function wraps read(2) so its signal-safe
 static ssize_t safe_read(int fd, char *buf, size_t size)
 {
@@ -418,7 +418,7 @@ char *get_hash_from_fd(int fd)
 {
 	gcry_md_hd_t ctx;
 	gcry_error_t error;
-	char fbuf[4096], *hptr, *digest;
+	char fbuf[HASH_READ_SIZE], *hptr, *digest;
 	ssize_t len;
 
 	// Initialize a context
@@ -427,9 +427,9 @@ char *get_hash_from_fd(int fd)
 		return NULL;
 
 	// read in a buffer at a time and hand to gcrypt
-	while ((len = safe_read(fd, fbuf, 4096)) > 0) {
+	while ((len = safe_read(fd, fbuf, HASH_READ_SIZE)) > 0) {
 		gcry_md_write(ctx, fbuf, len);
-		if (len != 4096)
+		if (len != HASH_READ_SIZE)
 			break;
 	}
 
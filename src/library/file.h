@@ -42,7 +42,7 @@ struct file_info
 
 void file_init(void);
 void file_close(void);
-struct file_info *stat_file_entry(int fd) MALLOCLIKE;
+int stat_file_entry(int fd, struct file_info *info);
 int compare_file_infos(const struct file_info *p1, const struct file_info *p2);
 char *get_file_from_fd(int fd, pid_t pid, size_t blen, char *buf);
 char *get_device_from_stat(unsigned int device, size_t blen, char *buf);
@@ -0,0 +1,348 @@
+/*
+ * hash-cache.c - Remember file hashes between fapolicyd-cli runs
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+ * The cache maps a path and its fingerprint (device, inode, size, mtime
+ * and ctime) to the sha256 of its contents. If the fingerprint of a file
+ * still matches, the file was not written since it was hashed and the
+ * hash can be reused. A file changed within a second of being hashed is
+ * not cached because a later write could keep the same timestamps.
+ */
+
+#include "config.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "hash-cache.h"
+#include "message.h"
+
+#define CACHE_HEADER "# fapolicyd trust hash cache 1\n"
+
+struct cache_entry {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	struct timespec ctime;
+	char sha[65];
+	int removed;
+};
+
+static struct cache_entry **slots;
+static size_t mask, used;
+static int dirty;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static size_t cache_hash(const char *path)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*path)
+		h = (h ^ (unsigned char)*path++) * 0x100000001b3ULL;
+	h ^= h >> 32;
+	return (size_t)h;
+}
+
+
+// Returns the slot for path, which is NULL if path is not cached
+static struct cache_entry **find_slot(const char *path)
+{
+	size_t i = cache_hash(path) & mask;
+
+	while (slots[i] && strcmp(slots[i]->path, path))
+		i = (i + 1) & mask;
+	return &slots[i];
+}
+
+
+static int grow(void)
+{
+	size_t i, size = slots ? (mask + 1) * 2 : 1024;
+	struct cache_entry **tmp = calloc(size, sizeof(*tmp));
+
+	if (tmp == NULL)
+		return 1;
+
+	for (i = 0; slots && i <= mask; i++) {
+		size_t j;
+
+		if (slots[i] == NULL)
+			continue;
+		j = cache_hash(slots[i]->path) & (size - 1);
+		while (tmp[j])
+			j = (j + 1) & (size - 1);
+		tmp[j] = slots[i];
+	}
+	free(slots);
+	slots = tmp;
+	mask = size - 1;
+	return 0;
+}
+
+
+static struct cache_entry *add_entry(const char *path)
+{
+	struct cache_entry **slot, *e;
+
+	if ((used + 1) * 2 > mask + 1 || slots == NULL)
+		if (grow())
+			return NULL;
+
+	slot = find_slot(path);
+	if (*slot)
+		return *slot;
+
+	e = calloc(1, sizeof(*e));
+	if (e == NULL)
+		return NULL;
+	e->path = strdup(path);
+	if (e->path == NULL) {
+		free(e);
+		return NULL;
+	}
+	*slot = e;
+	used++;
+	return e;
+}
+
+
+static void set_fingerprint(struct cache_entry *e, const struct stat *sb)
+{
+	e->dev = sb->st_dev;
+	e->ino = sb->st_ino;
+	e->size = sb->st_size;
+	e->mtime = sb->st_mtim;
+	e->ctime = sb->st_ctim;
+}
+
+
+static int same_fingerprint(const struct cache_entry *e,
+		const struct stat *sb)
+{
+	return e->dev == sb->st_dev && e->ino == sb->st_ino &&
+		e->size == sb->st_size &&
+		e->mtime.tv_sec == sb->st_mtim.tv_sec &&
+		e->mtime.tv_nsec == sb->st_mtim.tv_nsec &&
+		e->ctime.tv_sec == sb->st_ctim.tv_sec &&
+		e->ctime.tv_nsec == sb->st_ctim.tv_nsec;
+}
+
+
+/*
+ * Load the cache from file. A missing file is an empty cache. It returns
+ * 0 on success and 1 on error.
+ */
+int hash_cache_load(const char *file)
+{
+	char buf[4096 + 256];
+	FILE *f = fopen(file, "re");
+
+	if (f == NULL)
+		return errno == ENOENT ? 0 : 1;
+
+	if (fgets(buf, sizeof(buf), f) == NULL ||
+	    strcmp(buf, CACHE_HEADER)) {
+		// Unknown format, start over
+		fclose(f);
+		return 0;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		unsigned long long dev, ino;
+		long long size, msec, csec;
+		long mnsec, cnsec;
+		char sha[65], path[4097];
+		struct cache_entry *e;
+
+		if (sscanf(buf, "%llu %llu %lld %lld.%ld %lld.%ld %64s %4096s",
+			   &dev, &ino, &size, &msec, &mnsec, &csec, &cnsec,
+			   sha, path) != 9)
+			continue;
+
+		e = add_entry(path);
+		if (e == NULL)
+			break;
+		e->dev = dev;
+		e->ino = ino;
+		e->size = size;
+		e->mtime.tv_sec = msec;
+		e->mtime.tv_nsec = mnsec;
+		e->ctime.tv_sec = csec;
+		e->ctime.tv_nsec = cnsec;
+		strcpy(e->sha, sha);
+	}
+	fclose(f);
+	dirty = 0;
+
+	return 0;
+}
+
+
+/*
+ * Write the cache to file if it changed. A temporary file is renamed
+ * over it so a crash never leaves a partial cache. Returns 0 on success.
+ */
+int hash_cache_save(const char *file)
+{
+	char tmp[4096];
+	size_t i;
+	FILE *f;
+	int fd;
+
+	if (!dirty)
+		return 0;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", file) >=
+							(int)sizeof(tmp))
+		return 1;
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0) {
+		msg(LOG_WARNING, "Cannot save hash cache %s (%s)", file,
+		    strerror(errno));
+		return 1;
+	}
+	f = fdopen(fd, "w");
+	if (f == NULL) {
+		close(fd);
+		unlink(tmp);
+		return 1;
+	}
+
+	fputs(CACHE_HEADER, f);
+	for (i = 0; slots && i <= mask; i++) {
+		const struct cache_entry *e = slots[i];
+
+		if (e == NULL || e->removed)
+			continue;
+		fprintf(f, "%llu %llu %lld %lld.%09ld %lld.%09ld %s %s\n",
+			(unsigned long long)e->dev,
+			(unsigned long long)e->ino, (long long)e->size,
+			(long long)e->mtime.tv_sec, e->mtime.tv_nsec,
+			(long long)e->ctime.tv_sec, e->ctime.tv_nsec,
+			e->sha, e->path);
+	}
+
+	if (fflush(f) || fsync(fileno(f)) || ferror(f)) {
+		fclose(f);
+		unlink(tmp);
+		return 1;
+	}
+	fclose(f);
+
+	if (rename(tmp, file)) {
+		unlink(tmp);
+		return 1;
+	}
+	dirty = 0;
+
+	return 0;
+}
+
+
+/*
+ * If path is cached with the fingerprint in sb, copy its hash to sha,
+ * which must hold 65 bytes, and return 1. Otherwise return 0.
+ */
+int hash_cache_lookup(const char *path, const struct stat *sb, char *sha)
+{
+	struct cache_entry *e;
+	int rc = 0;
+
+	pthread_mutex_lock(&cache_lock);
+	if (slots) {
+		e = *find_slot(path);
+		if (e && !e->removed && same_fingerprint(e, sb)) {
+			strcpy(sha, e->sha);
+			rc = 1;
+		}
+	}
+	pthread_mutex_unlock(&cache_lock);
+
+	return rc;
+}
+
+
+void hash_cache_store(const char *path, const struct stat *sb,
+		const char *sha)
+{
+	struct cache_entry *e;
+	time_t now = time(NULL);
+
+	if (strlen(sha) != 64)
+		return;
+
+	pthread_mutex_lock(&cache_lock);
+	e = add_entry(path);
+	if (e) {
+		// Too recent to trust the timestamps, see the top
+		if (sb->st_mtim.tv_sec >= now - 1 ||
+		    sb->st_ctim.tv_sec >= now - 1)
+			e->removed = 1;
+		else {
+			set_fingerprint(e, sb);
+			strcpy(e->sha, sha);
+			e->removed = 0;
+		}
+		dirty = 1;
+	}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+
+// Drop every path that starts with prefix
+void hash_cache_forget(const char *prefix)
+{
+	size_t i, len = strlen(prefix);
+
+	pthread_mutex_lock(&cache_lock);
+	for (i = 0; slots && i <= mask; i++)
+		if (slots[i] && !slots[i]->removed &&
+		    strncmp(slots[i]->path, prefix, len) == 0) {
+			slots[i]->removed = 1;
+			dirty = 1;
+		}
+	pthread_mutex_unlock(&cache_lock);
+}
+
+
+void hash_cache_destroy(void)
+{
+	size_t i;
+
+	for (i = 0; slots && i <= mask; i++)
+		if (slots[i]) {
+			free(slots[i]->path);
+			free(slots[i]);
+		}
+	free(slots);
+	slots = NULL;
+	mask = used = 0;
+	dirty = 0;
+}
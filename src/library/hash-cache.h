@@ -0,0 +1,37 @@
+/*
+ * hash-cache.h - Header file for the file hash cache
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef HASH_CACHE_H
+#define HASH_CACHE_H
+
+#include <sys/stat.h>
+
+#define HASH_CACHE_PATH "/var/lib/fapolicyd/trust-hash.cache"
+
+int hash_cache_load(const char *file);
+int hash_cache_save(const char *file);
+int hash_cache_lookup(const char *path, const struct stat *sb, char *sha);
+void hash_cache_store(const char *path, const struct stat *sb,
+		const char *sha);
+void hash_cache_forget(const char *prefix);
+void hash_cache_destroy(void);
+
+#endif
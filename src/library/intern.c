@@ -0,0 +1,229 @@
+/*
+ * intern.c - Shared attribute strings
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+ * The intern table keeps one copy of each attribute string with a count
+ * of its users. Paths, exe names and file types repeat across many cache
+ * entries and rules, so they are stored once. A string is freed when its
+ * last user releases it.
+ */
+
+#include "config.h"
+#include <malloc.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "intern.h"
+
+struct istr {
+	struct istr *next;
+	uint32_t hash;
+	unsigned int refs;
+	char str[];
+};
+
+static struct istr **buckets;
+static size_t mask, count;
+static unsigned long refs;
+static pthread_mutex_t intern_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static uint32_t intern_hash(const char *str, size_t *len)
+{
+	const char *p = str;
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*p)
+		h = (h ^ (unsigned char)*p++) * 0x100000001b3ULL;
+	*len = p - str;
+	return (uint32_t)(h ^ (h >> 32));
+}
+
+
+static struct istr *to_istr(const char *str)
+{
+	return (struct istr *)(str - offsetof(struct istr, str));
+}
+
+
+static struct istr *lookup(const char *str, uint32_t hash)
+{
+	struct istr *s;
+
+	if (buckets == NULL)
+		return NULL;
+	for (s = buckets[hash & mask]; s; s = s->next)
+		if (s->hash == hash && strcmp(s->str, str) == 0)
+			return s;
+	return NULL;
+}
+
+
+// Keep about one string per bucket. Returns 1 if out of memory.
+static int grow(void)
+{
+	size_t i, size = buckets ? (mask + 1) * 2 : 1024;
+	struct istr **tmp = calloc(size, sizeof(*tmp));
+
+	if (tmp == NULL)
+		return 1;
+
+	for (i = 0; buckets && i <= mask; i++) {
+		struct istr *s = buckets[i], *next;
+
+		for (; s; s = next) {
+			next = s->next;
+			s->next = tmp[s->hash & (size - 1)];
+			tmp[s->hash & (size - 1)] = s;
+		}
+	}
+	free(buckets);
+	buckets = tmp;
+	mask = size - 1;
+	return 0;
+}
+
+
+// Returns the shared copy of str or NULL if out of memory
+const char *intern(const char *str)
+{
+	struct istr *s;
+	size_t len;
+	uint32_t hash = intern_hash(str, &len);
+
+	pthread_mutex_lock(&intern_lock);
+	s = lookup(str, hash);
+	if (s == NULL) {
+		if ((buckets == NULL || count > mask) && grow())
+			goto err;
+		s = malloc(sizeof(*s) + len + 1);
+		if (s == NULL)
+			goto err;
+		memcpy(s->str, str, len + 1);
+		s->hash = hash;
+		s->refs = 0;
+		s->next = buckets[hash & mask];
+		buckets[hash & mask] = s;
+		count++;
+	}
+	s->refs++;
+	refs++;
+	pthread_mutex_unlock(&intern_lock);
+
+	return s->str;
+err:
+	pthread_mutex_unlock(&intern_lock);
+	return NULL;
+}
+
+
+// Take another reference to a string that is already interned
+const char *intern_ref(const char *str)
+{
+	if (str == NULL)
+		return NULL;
+
+	pthread_mutex_lock(&intern_lock);
+	to_istr(str)->refs++;
+	refs++;
+	pthread_mutex_unlock(&intern_lock);
+
+	return str;
+}
+
+
+// Returns the shared copy of str without taking a reference, or NULL if
+// nobody uses that text. It is only valid while a reference is held.
+const char *intern_find(const char *str)
+{
+	struct istr *s;
+	size_t len;
+	uint32_t hash = intern_hash(str, &len);
+
+	pthread_mutex_lock(&intern_lock);
+	s = lookup(str, hash);
+	pthread_mutex_unlock(&intern_lock);
+
+	return s ? s->str : NULL;
+}
+
+
+void intern_release(const char *str)
+{
+	struct istr *s, **prev;
+
+	if (str == NULL)
+		return;
+
+	s = to_istr(str);
+	pthread_mutex_lock(&intern_lock);
+	refs--;
+	if (--s->refs == 0) {
+		for (prev = &buckets[s->hash & mask]; *prev != s;
+						prev = &(*prev)->next)
+			;
+		*prev = s->next;
+		count--;
+		free(s);
+	}
+	pthread_mutex_unlock(&intern_lock);
+}
+
+
+// Bytes of the string divided among its users
+size_t intern_share(const char *str)
+{
+	struct istr *s;
+	size_t bytes;
+
+	if (str == NULL)
+		return 0;
+
+	s = to_istr(str);
+	pthread_mutex_lock(&intern_lock);
+	bytes = malloc_usable_size(s) / s->refs;
+	pthread_mutex_unlock(&intern_lock);
+
+	return bytes;
+}
+
+
+void intern_report(FILE *f)
+{
+	size_t i, bytes = 0, copies = 0;
+	struct istr *s;
+
+	pthread_mutex_lock(&intern_lock);
+	for (i = 0; buckets && i <= mask; i++) {
+		for (s = buckets[i]; s; s = s->next) {
+			bytes += malloc_usable_size(s);
+			copies += (strlen(s->str) + 1) * s->refs;
+		}
+	}
+	fprintf(f, "Interned strings: %zu\n", count);
+	fprintf(f, "Interned references: %lu\n", refs);
+	fprintf(f, "Interned bytes: %zu (%zu without sharing)\n",
+		bytes + (buckets ? (mask + 1) * sizeof(*buckets) : 0), copies);
+	pthread_mutex_unlock(&intern_lock);
+}
@@ -0,0 +1,40 @@
+/*
+ * intern.h - Header file for the string intern table
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Interned strings are shared by everyone holding the same text, so two
+ * of them are equal exactly when their pointers are. They must not be
+ * written to. Every intern or intern_ref must be paired with a release.
+ */
+const char *intern(const char *str);
+const char *intern_ref(const char *str);
+const char *intern_find(const char *str);
+void intern_release(const char *str);
+size_t intern_share(const char *str);
+void intern_report(FILE *f);
+
+#endif
@@ -130,8 +130,9 @@ void list_merge(list_t *dest, list_t *src)
 {
 	if (!dest->last) {
 		*dest = *src;
-	} else {
+	} else if (src->first) {
 		dest->last->next = src->first;
+		dest->last = src->last;
 		dest->count += src->count;
 	}
 	list_init(src);
@@ -22,27 +22,68 @@
  *   Steve Grubb <sgrubb@redhat.com>
  */
 
+/*
+ * The cache is N-way set associative. The key, a hash of the full
+ * identity of an item, picks a set. The ways of the set are searched
+ * for an item with the same identity, so items whose keys land in the
+ * same set coexist. When a set is full, the replacement policy picks
+ * the way to give to the new item:
+ *
+ * lru   - the least recently used way. Every hit moves the node to the
+ *         front of the queue, so the queue is in order of use.
+ * clock - the first way without its reference bit, as a hand sweeps the
+ *         set clearing bits. A hit only sets a bit.
+ * 2q    - new items are on probation and a second hit protects them. The
+ *         least recently used item on probation goes first, so a scan
+ *         of files used once can't push out the ones used all the time.
+ *         At most 3/4 of a set is protected.
+ *
+ * With clock and 2q the queue is in order of insertion.
+ *
+ * The sets are split among stripes, each with its own lock, so threads
+ * looking up keys in different stripes don't wait on each other. The
+ * queue and the node slab have a lock of their own that is only taken
+ * inside a stripe lock. A node returned by check_lru_cache is pinned
+ * until lru_release or lru_evict. A pinned node pushed out of its set
+ * is only marked dead and is freed by whoever releases it last. The
+ * cache doesn't lock the items, users of the same item must agree on
+ * how to share it.
+ *
+ * The last keys pushed out of each set are kept as ghosts. A miss on a
+ * ghost would have been a hit if the cache were bigger. lru_resize uses
+ * a new hash for another number of sets, moving as many items as fit.
+ * Uses are stamped from one clock for the whole queue so items from
+ * different sets can still be compared after they share a new one.
+ */
+
 #include "config.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include "lru.h"
 #include "message.h"
-#include "gcc-attributes.h"
 
 //#define DEBUG
 
+#define LRU_WAYS 8
+#define LRU_STRIPES 64
+
 // Local declarations
 static void dequeue(Queue *queue);
 
 // The Queue Node will store the 'item' being cached
-static QNode *new_QNode(void) MALLOCLIKE;
-static QNode *new_QNode(void)
+static QNode *new_QNode(Queue *queue)
 {
-	QNode *temp = malloc(sizeof(QNode));
+	QNode *temp = slab_alloc(&queue->nodes);
 	if (temp == NULL)
 		return temp;
 	temp->item = NULL;
 	temp->uses = 1;	// Setting to 1 because its being used
+	temp->last = 0;
+	temp->key = 0;
+	temp->refs = 1;	// the reference of the cache
+	temp->dead = 0;
+	temp->bytes = 0;
 
 	// Initialize prev and next as NULL
 	temp->prev = temp->next = NULL;
@@ -50,42 +91,107 @@ static QNode *new_QNode(void)
 	return temp;
 }
 
-static Hash *create_hash(unsigned int hsize)
+static Hash *create_hash(unsigned int sets, unsigned int ways)
 {
-	unsigned int i;
-
 	Hash *hash = malloc(sizeof(Hash));
 	if (hash == NULL)
 		return hash;
 
-	hash->array = malloc(hsize * sizeof(QNode*));
-	if (hash->array == NULL) {
+	// Initialize all hash entries as empty
+	hash->array = calloc((size_t)sets * ways, sizeof(QNode*));
+	hash->meta = calloc(sets, sizeof(LSet));
+	hash->ghosts = calloc((size_t)sets * ways, sizeof(unsigned int));
+	if (hash->array == NULL || hash->meta == NULL ||
+						hash->ghosts == NULL) {
+		free(hash->array);
+		free(hash->meta);
+		free(hash->ghosts);
 		free(hash);
 		return NULL;
 	}
-
-	// Initialize all hash entries as empty
-	for (i = 0; i < hsize; i++)
-		hash->array[i] = NULL;
+	hash->sets = sets;
+	hash->ways = ways;
 
 	return hash;
 }
 
+// Return the set that key maps to
+static unsigned int find_set(const Hash *hash, unsigned int key)
+{
+	// Scale the key instead of using modulo so all key bits count
+	return ((uint64_t)key * hash->sets) >> 32;
+}
+
+// Return the first way of a set
+static QNode **set_ways(const Hash *hash, unsigned int set)
+{
+	return &hash->array[(size_t)set * hash->ways];
+}
+
+// Return the stripe that locks a set
+static LStripe *find_stripe(const Queue *queue, unsigned int set)
+{
+	return &queue->stripes[set % queue->nstripes];
+}
+
 static void destroy_hash(Hash *hash)
 {
 	free(hash->array);
+	free(hash->meta);
+	free(hash->ghosts);
 	free(hash);
 }
 
-static void dump_queue_stats(const Queue *q)
+const char *lru_policy_name(cache_policy_t policy)
+{
+	switch (policy) {
+		case POLICY_CLOCK:
+			return "clock";
+		case POLICY_2Q:
+			return "2q";
+		default:
+			return "lru";
+	}
+}
+
+// Add up the metrics of all stripes
+void lru_stats(Queue *queue, LStats *stats)
 {
+	unsigned int i;
+
+	memset(stats, 0, sizeof(LStats));
+	for (i = 0; i < queue->nstripes; i++) {
+		LStripe *stripe = &queue->stripes[i];
+
+		pthread_mutex_lock(&stripe->lock);
+		stats->hits += stripe->stats.hits;
+		stats->misses += stripe->stats.misses;
+		stats->collisions += stripe->stats.collisions;
+		stats->stale += stripe->stats.stale;
+		stats->second_chances += stripe->stats.second_chances;
+		stats->promotions += stripe->stats.promotions;
+		stats->protected_hits += stripe->stats.protected_hits;
+		stats->ghost_hits += stripe->stats.ghost_hits;
+		stats->trimmed += stripe->stats.trimmed;
+		pthread_mutex_unlock(&stripe->lock);
+	}
+}
+
+static void dump_queue_stats(Queue *q)
+{
+	LStats st;
+
+	lru_stats(q, &st);
 	msg(LOG_DEBUG, "%s cache size: %u", q->name, q->total);
 	msg(LOG_DEBUG, "%s slots in use: %u (%u%%)", q->name, q->count,
 				q->total ? (100*q->count)/q->total : 0);
-	msg(LOG_DEBUG, "%s hits: %lu", q->name, q->hits);
-	msg(LOG_DEBUG, "%s misses: %lu", q->name, q->misses);
-	msg(LOG_DEBUG, "%s evictions: %lu (%lu%%)", q->name, q->evictions,
-				q->hits ? (100*q->evictions)/q->hits : 0);
+	msg(LOG_DEBUG, "%s hits: %lu", q->name, st.hits);
+	msg(LOG_DEBUG, "%s misses: %lu", q->name, st.misses);
+	msg(LOG_DEBUG, "%s collisions: %lu (%lu%%)", q->name, st.collisions,
+				st.misses ? (100*st.collisions)/st.misses : 0);
+	msg(LOG_DEBUG, "%s stale: %lu (%lu%%)", q->name, st.stale,
+				st.hits ? (100*st.stale)/st.hits : 0);
+	msg(LOG_DEBUG, "%s policy: %s", q->name, lru_policy_name(q->policy));
 }
 
 static Queue *create_queue(unsigned int qsize, const char *name)
@@ -96,10 +202,14 @@ static Queue *create_queue(unsigned int qsize, const char *name)
 
 	// The queue is empty
 	queue->count = 0;
-	queue->hits = 0;
-	queue->misses = 0;
-	queue->evictions = 0;
+	queue->bytes = 0;
 	queue->front = queue->end = NULL;
+	queue->stripes = NULL;
+	queue->nstripes = 0;
+	atomic_init(&queue->clock, 0);
+	slab_init(&queue->nodes, sizeof(QNode), 256);
+	pthread_mutex_init(&queue->list_lock, NULL);
+	pthread_rwlock_init(&queue->resize_lock, NULL);
 
 	// Number of slots that can be stored in memory
 	queue->total = qsize;
@@ -109,21 +219,25 @@ static Queue *create_queue(unsigned int qsize, const char *name)
 	return queue;
 }
 
+// Nodes still in use when the queue is destroyed are lost
 static void destroy_queue(Queue *queue)
 {
+	unsigned int i;
+
 	dump_queue_stats(queue);
 
 	while (queue->count)
 		dequeue(queue);
 
+	for (i = 0; i < queue->nstripes; i++)
+		pthread_mutex_destroy(&queue->stripes[i].lock);
+	free(queue->stripes);
+	pthread_mutex_destroy(&queue->list_lock);
+	pthread_rwlock_destroy(&queue->resize_lock);
+	slab_destroy(&queue->nodes);
 	free(queue);
 }
 
-static unsigned int are_all_slots_full(const Queue *queue)
-{
-	return queue->count == queue->total;
-}
-
 static unsigned int queue_is_empty(const Queue *queue)
 {
 	return queue->end == NULL;
@@ -253,106 +367,648 @@ static void dequeue(Queue *queue)
 
 	remove_node(queue, queue->end);
 
-	queue->cleanup(temp->item);
-	free(temp->item);
-	free(temp);
+	if (temp->item)
+		queue->cleanup(temp->item);
+	slab_free(&queue->nodes, temp);
 
 	// decrement the total of full slots by 1
 	queue->count--;
 }
 
-// Remove front of the queue because its a mismatch
-void lru_evict(Queue *queue, unsigned int key)
+// Forget the replacement state of a way
+static void clear_way(Hash *hash, unsigned int set, unsigned int way)
 {
-	Hash *hash = queue->hash;
-	QNode *temp = queue->front;
+	hash->meta[set].ref &= ~(1U << way);
+	hash->meta[set].protect &= ~(1U << way);
+}
 
-	if (queue_is_empty(queue))
-		return;
+// Remember the key of an item pushed out of a full set
+static void add_ghost(Hash *hash, unsigned int set, unsigned int key)
+{
+	LSet *meta = &hash->meta[set];
+
+	hash->ghosts[(size_t)set * hash->ways + meta->ghost] = key;
+	meta->ghost = (meta->ghost + 1) % hash->ways;
+}
+
+// Returns 1 if key was recently pushed out of the set
+static int find_ghost(Hash *hash, unsigned int set, unsigned int key)
+{
+	unsigned int *ghosts = &hash->ghosts[(size_t)set * hash->ways], i;
+
+	if (key == 0)
+		return 0;
+	for (i = 0; i < hash->ways; i++) {
+		if (ghosts[i] == key) {
+			ghosts[i] = 0;
+			return 1;
+		}
+	}
+	return 0;
+}
 
-	hash->array[key] = NULL;
-	remove_node(queue, queue->front);
+static void move_to_front(Queue *queue, QNode *node);
 
-	queue->cleanup(temp->item);
-	free(temp->item);
-	free(temp);
+// Take the node in a way out of the cache and drop the reference of the
+// cache. The stripe lock is held. Returns 1 if nobody uses the node.
+static int detach_node(Queue *queue, unsigned int set, unsigned int way)
+{
+	QNode **ways = set_ways(queue->hash, set);
+	QNode *node = ways[way];
 
-        // decrement the total of full slots by 1
+	ways[way] = NULL;
+	clear_way(queue->hash, set, way);
+	node->dead = 1;
+
+	pthread_mutex_lock(&queue->list_lock);
+	remove_node(queue, node);
+	// decrement the total of full slots by 1
 	queue->count--;
-	queue->evictions++;
+	queue->bytes -= node->bytes;
+	pthread_mutex_unlock(&queue->list_lock);
+
+	return --node->refs == 0;
+}
+
+// Free a node that is out of the cache and not used anymore
+static void free_node(Queue *queue, QNode *node)
+{
+	if (node->item)
+		queue->cleanup(node->item);
+
+	pthread_mutex_lock(&queue->list_lock);
+	slab_free(&queue->nodes, node);
+	pthread_mutex_unlock(&queue->list_lock);
+}
+
+// Remove a node whose item can't be used anymore. This drops the
+// reference the caller got from check_lru_cache.
+void lru_evict(Queue *queue, QNode *node)
+{
+	unsigned int set, i, unused;
+	LStripe *stripe;
+	QNode **ways;
+
+	if (node == NULL)
+		return;
+
+	pthread_rwlock_rdlock(&queue->resize_lock);
+	set = find_set(queue->hash, node->key);
+	stripe = find_stripe(queue, set);
+	pthread_mutex_lock(&stripe->lock);
+	if (!node->dead) {
+		ways = set_ways(queue->hash, set);
+		for (i = 0; i < queue->hash->ways; i++) {
+			if (ways[i] == node) {
+				detach_node(queue, set, i);
+				break;
+			}
+		}
+		stripe->stats.stale++;
+	}
+	unused = --node->refs == 0;
+	pthread_mutex_unlock(&stripe->lock);
+
+	if (unused)
+		free_node(queue, node);
+	pthread_rwlock_unlock(&queue->resize_lock);
+}
+
+// Drop the reference the caller got from check_lru_cache
+void lru_release(Queue *queue, QNode *node)
+{
+	LStripe *stripe;
+	unsigned int unused;
+
+	if (node == NULL)
+		return;
+
+	// The key of a node in use doesn't change
+	pthread_rwlock_rdlock(&queue->resize_lock);
+	stripe = find_stripe(queue, find_set(queue->hash, node->key));
+	pthread_mutex_lock(&stripe->lock);
+	unused = --node->refs == 0;
+	pthread_mutex_unlock(&stripe->lock);
+
+	if (unused)
+		free_node(queue, node);
+	pthread_rwlock_unlock(&queue->resize_lock);
 }
 
-// Make a new entry with item to be assigned later
-// and setup the hash key
-static void enqueue(Queue *queue, unsigned int key)
+// Give the item to the node the caller got on a miss
+void lru_set_item(Queue *queue, QNode *node, void *item)
+{
+	LStripe *stripe;
+
+	pthread_rwlock_rdlock(&queue->resize_lock);
+	stripe = find_stripe(queue, find_set(queue->hash, node->key));
+	pthread_mutex_lock(&stripe->lock);
+	node->item = item;
+	pthread_mutex_unlock(&stripe->lock);
+	pthread_rwlock_unlock(&queue->resize_lock);
+}
+
+// Record the memory of an item. The stripe lock is held.
+static void charge_node(Queue *queue, QNode *node, size_t bytes)
+{
+	pthread_mutex_lock(&queue->list_lock);
+	queue->bytes += bytes - node->bytes;
+	node->bytes = bytes;
+	pthread_mutex_unlock(&queue->list_lock);
+}
+
+// Record how much memory the item of a node in use takes
+void lru_set_bytes(Queue *queue, QNode *node, size_t bytes)
+{
+	LStripe *stripe;
+
+	pthread_rwlock_rdlock(&queue->resize_lock);
+	stripe = find_stripe(queue, find_set(queue->hash, node->key));
+	pthread_mutex_lock(&stripe->lock);
+	// A dead node isn't counted anymore
+	if (node->dead)
+		node->bytes = bytes;
+	else
+		charge_node(queue, node, bytes);
+	pthread_mutex_unlock(&stripe->lock);
+	pthread_rwlock_unlock(&queue->resize_lock);
+}
+
+// Memory of the items in the cache
+size_t lru_bytes(Queue *queue)
+{
+	size_t bytes;
+
+	pthread_mutex_lock(&queue->list_lock);
+	bytes = queue->bytes;
+	pthread_mutex_unlock(&queue->list_lock);
+	return bytes;
+}
+
+// Memory of the cache itself: nodes, sets and stripes
+size_t lru_fixed_bytes(Queue *queue)
+{
+	size_t bytes;
+
+	pthread_rwlock_rdlock(&queue->resize_lock);
+	pthread_mutex_lock(&queue->list_lock);
+	bytes = queue->nodes.in_use * queue->nodes.size +
+		(size_t)queue->hash->sets * queue->hash->ways *
+			(sizeof(QNode *) + sizeof(unsigned int)) +
+		queue->hash->sets * sizeof(LSet) +
+		queue->nstripes * sizeof(LStripe) +
+		sizeof(Queue) + sizeof(Hash);
+	pthread_mutex_unlock(&queue->list_lock);
+	pthread_rwlock_unlock(&queue->resize_lock);
+	return bytes;
+}
+
+/*
+ * Push items out from the end of the queue until the items take at most
+ * bytes of memory. Items in use are freed when released. It returns how
+ * many items were pushed out.
+ */
+unsigned int lru_trim(Queue *queue, size_t bytes)
+{
+	unsigned int cnt = 0;
+
+	pthread_rwlock_rdlock(&queue->resize_lock);
+	for (;;) {
+		unsigned int set, i, key;
+		LStripe *stripe;
+		QNode *node, **ways;
+
+		pthread_mutex_lock(&queue->list_lock);
+		node = queue->bytes > bytes ? queue->end : NULL;
+		key = node ? node->key : 0;
+		pthread_mutex_unlock(&queue->list_lock);
+		if (node == NULL)
+			break;
+
+		// The node may leave the queue before its stripe is locked
+		set = find_set(queue->hash, key);
+		stripe = find_stripe(queue, set);
+		ways = set_ways(queue->hash, set);
+		pthread_mutex_lock(&stripe->lock);
+		for (i = 0; i < queue->hash->ways; i++) {
+			if (ways[i] == node) {
+				if (detach_node(queue, set, i))
+					free_node(queue, node);
+				stripe->stats.trimmed++;
+				cnt++;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&stripe->lock);
+	}
+	pthread_rwlock_unlock(&queue->resize_lock);
+
+	return cnt;
+}
+
+// Empty the cache. Items still in use are freed when released.
+void lru_flush(Queue *queue)
+{
+	Hash *hash;
+	unsigned int set, i;
+
+	pthread_rwlock_rdlock(&queue->resize_lock);
+	hash = queue->hash;
+	for (set = 0; set < hash->sets; set++) {
+		LStripe *stripe = find_stripe(queue, set);
+		QNode **ways = set_ways(hash, set);
+
+		pthread_mutex_lock(&stripe->lock);
+		for (i = 0; i < hash->ways; i++) {
+			QNode *node = ways[i];
+
+			if (node && detach_node(queue, set, i))
+				free_node(queue, node);
+		}
+		hash->meta[set].hand = 0;
+		pthread_mutex_unlock(&stripe->lock);
+	}
+	pthread_rwlock_unlock(&queue->resize_lock);
+}
+
+// Take the items that stale says can't be used anymore out of the
+// cache. Items still in use are freed when released. It returns how
+// many items were taken out.
+unsigned int lru_prune(Queue *queue, int (*stale)(void *item, void *arg),
+		void *arg)
+{
+	Hash *hash;
+	unsigned int set, i, cnt = 0;
+
+	pthread_rwlock_rdlock(&queue->resize_lock);
+	hash = queue->hash;
+	for (set = 0; set < hash->sets; set++) {
+		LStripe *stripe = find_stripe(queue, set);
+		QNode **ways = set_ways(hash, set);
+
+		pthread_mutex_lock(&stripe->lock);
+		for (i = 0; i < hash->ways; i++) {
+			QNode *node = ways[i];
+
+			if (node == NULL || node->item == NULL ||
+					!stale(node->item, arg))
+				continue;
+			if (detach_node(queue, set, i))
+				free_node(queue, node);
+			stripe->stats.stale++;
+			cnt++;
+		}
+		pthread_mutex_unlock(&stripe->lock);
+	}
+	pthread_rwlock_unlock(&queue->resize_lock);
+	return cnt;
+}
+
+static void move_to_front(Queue *queue, QNode *node)
+{
+	pthread_mutex_lock(&queue->list_lock);
+	if (node != queue->front) {
+		remove_node(queue, node);
+		node->next = NULL;
+		node->prev = NULL;
+		insert_beginning(queue, node);
+	}
+	pthread_mutex_unlock(&queue->list_lock);
+}
+
+// Return the least recently used way whose protect bit is prot, or -1
+static int oldest_way(QNode **ways, unsigned int nways, unsigned int mask,
+		unsigned int prot)
+{
+	int oldest = -1;
+	unsigned int i;
+
+	for (i = 0; i < nways; i++) {
+		if (!!(mask & (1U << i)) != prot)
+			continue;
+		if (oldest < 0 || ways[i]->last < ways[oldest]->last)
+			oldest = i;
+	}
+	return oldest;
+}
+
+// Record a hit on a way according to the policy
+static void touch_way(Queue *queue, LStripe *stripe, unsigned int set,
+		unsigned int way, QNode *node, unsigned long now)
 {
-	QNode *temp;
 	Hash *hash = queue->hash;
+	LSet *meta = &hash->meta[set];
+	unsigned int bit = 1U << way;
 
-	// If all slots are full, remove the page at the end
-	if (are_all_slots_full(queue)) {
-		// remove page from hash
-		hash->array[key] = NULL;
-		dequeue(queue);
+	switch (queue->policy) {
+	case POLICY_CLOCK:
+		meta->ref |= bit;
+		break;
+	case POLICY_2Q:
+		node->last = now;
+		if (meta->protect & bit) {
+			stripe->stats.protected_hits++;
+			break;
+		}
+		// Make room by putting the oldest protected item on probation
+		if ((unsigned int)__builtin_popcount(meta->protect) >=
+						hash->ways * 3 / 4) {
+			int old = oldest_way(set_ways(hash, set), hash->ways,
+					     meta->protect, 1);
+			if (old < 0)
+				break;
+			meta->protect &= ~(1U << old);
+		}
+		meta->protect |= bit;
+		stripe->stats.promotions++;
+		break;
+	default:
+		move_to_front(queue, node);
+		node->last = now;
+		break;
 	}
+}
 
-	// Create a new node with given page total,
-	// And add the new node to the front of queue
-	temp = new_QNode();
+// Pick the way of a set to give to a new item
+static unsigned int pick_way(Queue *queue, LStripe *stripe,
+		unsigned int set)
+{
+	Hash *hash = queue->hash;
+	QNode **ways = set_ways(hash, set);
+	LSet *meta = &hash->meta[set];
+	unsigned int i;
+	int way;
 
-	insert_beginning(queue, temp);
-	hash->array[key] = temp;
+	// An empty way goes first, then one never filled in that
+	// nobody is filling in
+	for (i = 0; i < hash->ways; i++)
+		if (ways[i] == NULL)
+			return i;
+	for (i = 0; i < hash->ways; i++)
+		if (ways[i]->item == NULL && ways[i]->refs == 1)
+			return i;
 
-	// increment number of full slots
-	queue->count++;
+	switch (queue->policy) {
+	case POLICY_CLOCK:
+		// Every way gets a second chance, so two sweeps are enough
+		for (i = 0; i < 2 * hash->ways; i++) {
+			unsigned int hand = meta->hand;
+
+			meta->hand = (hand + 1) % hash->ways;
+			if (!(meta->ref & (1U << hand)))
+				return hand;
+			meta->ref &= ~(1U << hand);
+			stripe->stats.second_chances++;
+		}
+		return meta->hand;
+	case POLICY_2Q:
+		way = oldest_way(ways, hash->ways, meta->protect, 0);
+		if (way < 0)
+			way = oldest_way(ways, hash->ways, meta->protect, 1);
+		return way;
+	default:
+		return oldest_way(ways, hash->ways, 0, 0);
+	}
 }
 
 // This function is called needing an item from cache.
 //  There are two scenarios:
-// 1. Item is not in cache, so add it to the front of the queue
-// 2. Item is in cache, we move the item to front of queue
-QNode *check_lru_cache(Queue *queue, unsigned int key)
+// 1. Item is in its set, the hit is recorded by the policy
+// 2. Item is not in cache. It gets a way of its set picked by the
+//    policy. The node is returned with a NULL item for the caller to
+//    fill in with lru_set_item.
+// Either way the node is pinned until lru_release or lru_evict.
+QNode *check_lru_cache(Queue *queue, unsigned int key, const void *id)
 {
-	QNode *reqPage;
-	Hash *hash = queue->hash;
+	Hash *hash;
+	unsigned int set, i;
+	unsigned long now;
+	LStripe *stripe;
+	QNode **ways, *node;
+	void *old = NULL;
 
-	// Check for out of bounds key
-	if (key >= queue->total) {
-		return NULL;
+	pthread_rwlock_rdlock(&queue->resize_lock);
+	hash = queue->hash;
+	set = find_set(hash, key);
+	stripe = find_stripe(queue, set);
+	ways = set_ways(hash, set);
+	pthread_mutex_lock(&stripe->lock);
+	// One clock for all sets keeps the uses comparable after a resize
+	now = atomic_fetch_add_explicit(&queue->clock, 1,
+					memory_order_relaxed) + 1;
+
+	for (i = 0; i < hash->ways; i++) {
+		node = ways[i];
+		if (node && node->key == key && node->item &&
+					queue->match(node->item, id)) {
+			touch_way(queue, stripe, set, i, node, now);
+
+			// Increment cached object metrics
+			node->uses++;
+			node->refs++;
+			stripe->stats.hits++;
+			goto out;
+		}
 	}
 
-	reqPage = hash->array[key];
+	stripe->stats.misses++;
+	if (find_ghost(hash, set, key))
+		stripe->stats.ghost_hits++;
+	i = pick_way(queue, stripe, set);
+	node = ways[i];
+	if (node && node->refs > 1) {
+		// Someone still uses it, it gets freed when they are done
+		if (node->item) {
+			add_ghost(hash, set, node->key);
+			stripe->stats.collisions++;
+		}
+		detach_node(queue, set, i);
+		node = NULL;
+	}
+	if (node == NULL) {
+		// Create a new node and add it to the front of queue
+		pthread_mutex_lock(&queue->list_lock);
+		node = new_QNode(queue);
+		if (node) {
+			insert_beginning(queue, node);
+			// increment number of full slots
+			queue->count++;
+		}
+		pthread_mutex_unlock(&queue->list_lock);
+		if (node == NULL)
+			goto out;
+		ways[i] = node;
+	} else {
+		// Give the way of an unrelated item to this one
+		if (node->item) {
+			old = node->item;
+			node->item = NULL;
+			add_ghost(hash, set, node->key);
+			stripe->stats.collisions++;
+		}
+		node->uses = 1;
+		charge_node(queue, node, 0);
+		move_to_front(queue, node);
+	}
+	// A new item starts unreferenced and on probation
+	clear_way(hash, set, i);
+	node->key = key;
+	node->last = now;
+	node->refs++;
+out:
+	pthread_mutex_unlock(&stripe->lock);
+	pthread_rwlock_unlock(&queue->resize_lock);
 
-	// item is not in cache, make new spot for it
-	if (reqPage == NULL) {
-		enqueue(queue, key);
-		queue->misses++;
+	// Nobody else can see the old item anymore
+	if (old)
+		queue->cleanup(old);
 
-	// item is there but not at front. Move it
-	} else if (reqPage != queue->front) {
-		remove_node(queue, reqPage);
-		reqPage->next = NULL;
-		reqPage->prev = NULL;
-		insert_beginning(queue, reqPage);
+	return node;
+}
 
-		// Increment cached object metrics
-		queue->front->uses++;
-		queue->hits++;
-	} else
-		queue->hits++;
+// Return the way of its set that holds a node in the cache
+static unsigned int find_way(const Hash *hash, unsigned int set,
+		const QNode *node)
+{
+	QNode **ways = set_ways(hash, set);
+	unsigned int i;
 
-	return queue->front;
+	for (i = 0; i < hash->ways; i++)
+		if (ways[i] == node)
+			break;
+	return i;
 }
 
-Queue *init_lru(unsigned int qsize, void (*cleanup)(void *),
-		const char *name)
+// Returns 1 if the way of a node is referenced or protected
+static int is_hot(const Hash *hash, const QNode *node)
 {
-	Queue *q = create_queue(qsize, name);
+	unsigned int set = find_set(hash, node->key);
+	unsigned int way = find_way(hash, set, node);
+
+	return way < hash->ways &&
+		((hash->meta[set].ref | hash->meta[set].protect) >> way) & 1;
+}
+
+// Put a node into a free way of its new set and carry over the bits of
+// its old way. Returns 1 if the new set is full.
+static int rehash_node(const Hash *old, Hash *hash, QNode *node)
+{
+	unsigned int oset = find_set(old, node->key);
+	unsigned int oway = find_way(old, oset, node);
+	unsigned int set = find_set(hash, node->key);
+	QNode **slot = set_ways(hash, set);
+	LSet *meta = &hash->meta[set];
+	unsigned int i;
+
+	for (i = 0; i < hash->ways; i++)
+		if (slot[i] == NULL)
+			break;
+	if (i == hash->ways)
+		return 1;
+
+	slot[i] = node;
+	if (oway < old->ways) {
+		if ((old->meta[oset].ref >> oway) & 1)
+			meta->ref |= 1U << i;
+		// Sets merged by a shrink still protect at most 3/4
+		if (((old->meta[oset].protect >> oway) & 1) &&
+				(unsigned int)__builtin_popcount(meta->protect)
+						< hash->ways * 3 / 4)
+			meta->protect |= 1U << i;
+	}
+	return 0;
+}
+
+/*
+ * Change the number of slots to about qsize without a flush. The items
+ * whose ways are referenced or protected are moved into the new sets
+ * first and keep their bits, then the rest from the front of the queue.
+ * The ones that don't fit anymore are freed, or marked dead if in use.
+ * Returns 0 on success and 1 if out of memory.
+ */
+int lru_resize(Queue *queue, unsigned int qsize)
+{
+	Hash *hash, *old;
+	QNode *node, *next;
+	unsigned int sets, ways;
+	int hot;
+
+	pthread_rwlock_wrlock(&queue->resize_lock);
+	old = queue->hash;
+	ways = old->ways;
+	sets = (qsize + ways - 1) / ways;
+	if (sets == 0)
+		sets = 1;
+	if (sets == old->sets) {
+		pthread_rwlock_unlock(&queue->resize_lock);
+		return 0;
+	}
+	hash = create_hash(sets, ways);
+	if (hash == NULL) {
+		pthread_rwlock_unlock(&queue->resize_lock);
+		return 1;
+	}
+
+	// Nobody else is in the cache, no other lock is needed
+	for (hot = 1; hot >= 0; hot--) {
+		for (node = queue->front; node; node = next) {
+			next = node->next;
+			if (is_hot(old, node) != hot)
+				continue;
+			if (rehash_node(old, hash, node) == 0)
+				continue;
+
+			add_ghost(hash, find_set(hash, node->key), node->key);
+			remove_node(queue, node);
+			queue->count--;
+			queue->bytes -= node->bytes;
+			node->dead = 1;
+			if (--node->refs == 0)
+				free_node(queue, node);
+		}
+	}
+
+	queue->hash = hash;
+	queue->total = sets * ways;
+	destroy_hash(old);
+	pthread_rwlock_unlock(&queue->resize_lock);
+
+	return 0;
+}
+
+Queue *init_lru(unsigned int qsize, cache_policy_t policy,
+		void (*cleanup)(void *),
+		int (*match)(const void *, const void *), const char *name)
+{
+	unsigned int ways = qsize < LRU_WAYS ? qsize : LRU_WAYS, sets, i;
+
+	if (ways == 0)
+		ways = 1;
+	sets = (qsize + ways - 1) / ways;
+	if (sets == 0)
+		sets = 1;
+
+	Queue *q = create_queue(sets * ways, name);
 	if (q == NULL)
 		return q;
 
+	q->policy = policy;
 	q->cleanup = cleanup;
-	q->hash = create_hash(qsize);
+	q->match = match;
+	// The stripes stay when the number of sets changes
+	q->nstripes = LRU_STRIPES;
+	q->stripes = calloc(q->nstripes, sizeof(LStripe));
+	q->hash = create_hash(sets, ways);
+	if (q->hash == NULL || q->stripes == NULL) {
+		if (q->hash)
+			destroy_hash(q->hash);
+		free(q->stripes);
+		slab_destroy(&q->nodes);
+		free(q);
+		return NULL;
+	}
+	for (i = 0; i < q->nstripes; i++)
+		pthread_mutex_init(&q->stripes[i].lock, NULL);
 
 	return q;
 }
@@ -366,18 +1022,37 @@ void destroy_lru(Queue *queue)
 	destroy_queue(queue);
 }
 
-unsigned int compute_subject_key(const Queue *queue, unsigned int pid)
+// Mix the bits of x so that every input bit affects every output bit
+static uint64_t mix64(uint64_t x)
 {
-	if (queue)
-		return pid % queue->total;
-	else
-		return 0;
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
 }
 
-unsigned long compute_object_key(const Queue *queue, unsigned long num)
+// The pid and start time of a process identify it
+unsigned int compute_subject_key(unsigned int pid,
+		const struct timespec *start)
 {
-	if (queue)
-		return num % queue->total;
-	else
-		return 0;
+	uint64_t h = mix64(pid);
+
+	h = mix64(h ^ (uint64_t)start->tv_sec);
+	h = mix64(h ^ (uint64_t)start->tv_nsec);
+	return (unsigned int)(h >> 32);
+}
+
+// The device, inode, modification time and size identify a file
+unsigned int compute_object_key(unsigned long device, unsigned long inode,
+		const struct timespec *mtime, unsigned long size)
+{
+	uint64_t h = mix64(inode);
+
+	h = mix64(h ^ device);
+	h = mix64(h ^ (uint64_t)mtime->tv_sec);
+	h = mix64(h ^ (uint64_t)mtime->tv_nsec);
+	h = mix64(h ^ size);
+	return (unsigned int)(h >> 32);
 }
@@ -25,43 +25,115 @@
 #ifndef LRU_HEADER
 #define LRU_HEADER
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "slab.h"
+
+// How a full set picks the way to give to a new item
+typedef enum {
+	POLICY_LRU,	// least recently used, hits reorder the queue
+	POLICY_CLOCK,	// hits only set a reference bit
+	POLICY_2Q	// new items must be hit again to be protected
+} cache_policy_t;
+
 // Queue is implemented using double linked list
 typedef struct QNode
 {
 	struct QNode *prev;
 	struct QNode *next;
 	unsigned long uses;
+	unsigned long last;	// queue clock of the last use
+	unsigned int key;	// hash of the identity of the item
+	unsigned int refs;	// one for the cache plus one per user
+	unsigned int dead;	// out of the cache, freed by the last user
+	size_t bytes;		// memory of the item when last measured
 	void *item;        // the data in the cache
 } QNode;
 
-// Collection of pointers to Queue Nodes
+// Replacement state of a set, one bit per way
+typedef struct LSet
+{
+	unsigned char ref;     // CLOCK: way was used since the hand passed
+	unsigned char protect; // 2Q: way was hit after it was filled
+	unsigned char hand;    // CLOCK: next way to look at
+	unsigned char ghost;   // next ghost to replace
+} LSet;
+
+// Collection of pointers to Queue Nodes, grouped into sets of ways
 typedef struct Hash
 {
-	unsigned int size; // how many entries
+	unsigned int sets;  // how many sets
+	unsigned int ways;  // entries per set
 	QNode **array;     // an array of queue nodes
+	LSet *meta;        // one per set
+	unsigned int *ghosts; // keys of items pushed out, ways per set
 } Hash;
 
+// Cache metrics
+typedef struct LStats
+{
+	unsigned long hits;  // Number of times object was in cache
+	unsigned long misses;// number of times object was not in cache
+	unsigned long collisions;// cached object pushed out of a full set
+	unsigned long stale; // number of times cached object was not usable
+	unsigned long second_chances; // CLOCK: referenced ways passed over
+	unsigned long promotions; // 2Q: items hit again while on probation
+	unsigned long protected_hits; // 2Q: hits on protected items
+	unsigned long ghost_hits; // misses on items recently pushed out
+	unsigned long trimmed; // pushed out to stay under a byte limit
+} LStats;
+
+// A lock for every nstripes'th set and the metrics of those sets
+typedef struct LStripe
+{
+	pthread_mutex_t lock;
+	LStats stats;
+} LStripe;
+
 // FIFO of Queue Nodes
 typedef struct Queue
 {
 	unsigned int count;  // Number of filled slots
 	unsigned int total;  // total number of slots
-	unsigned long hits;  // Number of times object was in cache
-	unsigned long misses;// number of times object was not in cache
-	unsigned long evictions;// number of times cached object was not usable
+	size_t bytes;	     // memory of the items
+	cache_policy_t policy;
 	QNode *front;
 	QNode *end;
 	Hash *hash;
+	LStripe *stripes;
+	unsigned int nstripes;
+	atomic_ulong clock;	// counts lookups, orders uses of all sets
+	pthread_mutex_t list_lock; // front, end, count, bytes and nodes
+	pthread_rwlock_t resize_lock; // written only to change the hash
 	const char *name;	// Used for reporting
-	void (*cleanup)(void *); // Function to call when releasing memory
+	void (*cleanup)(void *); // Function to call to release an item
+	slab_t nodes;		// QNodes come from here
+	// Returns 1 if the item has the identity id
+	int (*match)(const void *item, const void *id);
 } Queue;
 
-Queue *init_lru(unsigned int qsize, void (*cleanup)(void *),
-		const char *name);
+Queue *init_lru(unsigned int qsize, cache_policy_t policy,
+		void (*cleanup)(void *),
+		int (*match)(const void *, const void *), const char *name);
 void destroy_lru(Queue *queue);
-void lru_evict(Queue *queue, unsigned int key);
-QNode *check_lru_cache(Queue *q, unsigned int key);
-unsigned int compute_subject_key(const Queue *queue, unsigned int pid);
-unsigned long compute_object_key(const Queue *queue, unsigned long num);
+const char *lru_policy_name(cache_policy_t policy);
+void lru_evict(Queue *queue, QNode *node);
+QNode *check_lru_cache(Queue *q, unsigned int key, const void *id);
+void lru_set_item(Queue *queue, QNode *node, void *item);
+void lru_release(Queue *queue, QNode *node);
+void lru_flush(Queue *queue);
+unsigned int lru_prune(Queue *queue, int (*stale)(void *item, void *arg),
+		void *arg);
+void lru_stats(Queue *queue, LStats *stats);
+int lru_resize(Queue *queue, unsigned int qsize);
+void lru_set_bytes(Queue *queue, QNode *node, size_t bytes);
+size_t lru_bytes(Queue *queue);
+size_t lru_fixed_bytes(Queue *queue);
+unsigned int lru_trim(Queue *queue, size_t bytes);
+unsigned int compute_subject_key(unsigned int pid,
+		const struct timespec *start);
+unsigned int compute_object_key(unsigned long device, unsigned long inode,
+		const struct timespec *mtime, unsigned long size);
 
 #endif
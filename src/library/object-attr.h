@@ -39,7 +39,7 @@ typedef enum { ALL_OBJ = OBJ_START, PATH, ODIR, DEVICE, FTYPE,
 typedef struct o {
 	object_type_t type;
 	int val;	// holds trust value
-	char *o;	// Everything is a string
+	const char *o;	// Everything is an interned string
 
 	union {
 		size_t gr_index;
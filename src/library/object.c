@@ -28,6 +28,7 @@
 #include <errno.h>
 #include "policy.h"
 #include "object.h"
+#include "intern.h"
 #include "message.h"
 
 //#define DEBUG
@@ -36,11 +37,11 @@ void object_create(o_array *a)
 {
 	int i;
 
-	a->obj = malloc(sizeof(object_attr_t *) * ((OBJ_END-OBJ_START)+1));
-	for (i = 0; i < OBJ_END - OBJ_START; i++)
+	for (i = 0; i < OBJ_NUM; i++)
 		a->obj[i] = NULL;
 	a->cnt = 0;
-	a->info = NULL;
+	a->info = &a->file;
+	a->restored = 0;
 }
 
 #ifdef DEBUG
@@ -48,7 +49,7 @@ static void sanity_check_array(o_array *a, const char *id)
 {
 	int i;
 	unsigned int num = 0;
-	for (i = 0; i < OBJ_END - OBJ_START; i++)
+	for (i = 0; i < OBJ_NUM; i++)
 		if (a->obj[i])
 			num++;
 	if (num != a->cnt) {
@@ -77,9 +78,7 @@ int object_add(o_array *a, const object_attr_t *obj)
 	sanity_check_array(a, "object_add 1");
 	if (obj) {
 		if (obj->type >= OBJ_START && obj->type <= OBJ_END) {
-			newnode = malloc(sizeof(object_attr_t));
-			if (newnode == NULL)
-				return 1;
+			newnode = &a->attr[obj->type - OBJ_START];
 			newnode->type = obj->type;
 			newnode->o = obj->o;
 			newnode->val = obj->val;
@@ -104,22 +103,30 @@ object_attr_t *object_find_file(const o_array *a)
 }
 
 
+// Bytes of memory taken by the object with its share of the strings
+size_t object_bytes(const o_array *a)
+{
+	size_t bytes = sizeof(o_array);
+	int i;
+
+	for (i = 0; i < OBJ_NUM; i++)
+		if (a->obj[i])
+			bytes += intern_share(a->obj[i]->o);
+	return bytes;
+}
+
+
 void object_clear(o_array *a)
 {
 	int i;
-	object_attr_t *current;
 
 	if (a == NULL)
 		return;
 
-	for (i = 0; i < OBJ_END - OBJ_START; i++) {
-		current = a->obj[i];
-		if (current == NULL)
-			continue;
-		free(current->o);
-		free(current);
+	for (i = 0; i < OBJ_NUM; i++) {
+		if (a->obj[i])
+			intern_release(a->obj[i]->o);
+		a->obj[i] = NULL;
 	}
-	free(a->info);
-	free(a->obj);
 	a->cnt = 0;
 }
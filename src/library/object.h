@@ -28,18 +28,25 @@
 #include "object-attr.h"
 #include "file.h"
 
+#define OBJ_NUM (OBJ_END - OBJ_START + 1)
+
 /* This is the linked list head. Only data elements that are 1 per
- * event goes here. */
+ * event goes here. Everything is inside, so it is one allocation. */
 typedef struct {
-  object_attr_t **obj;	// Object array
+  object_attr_t *obj[OBJ_NUM];	// Object array
   unsigned int cnt;	// How many items in this list
   struct file_info *info; // unique file fingerprint
+  object_attr_t attr[OBJ_NUM];	// storage for obj
+  struct file_info file;	// storage for info
+  struct timespec ctime;	// change time when restored from a snapshot
+  unsigned int restored;	// not checked against ctime yet
 } o_array;
 
 void object_create(o_array *a);
 object_attr_t *object_access(const o_array *a, object_type_t t);
 int object_add(o_array *a, const object_attr_t *obj);
 object_attr_t *object_find_file(const o_array *a);
+size_t object_bytes(const o_array *a);
 void object_clear(o_array *a);
 static inline int type_is_obj(int type) {if (type >= OBJ_START) return 1; else return 0;}
 
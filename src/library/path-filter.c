@@ -0,0 +1,356 @@
+/*
+ * path-filter.c - Decide which packaged files go in the trust database
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+ * The filter is made of lines like these:
+ *
+ *   drop /usr/share/
+ *   keep /usr/share/ *.py
+ *   keep /usr/share/ * /libexec/ *	(written without the spaces)
+ *
+ * A line with just a prefix says what happens to files under it. The
+ * longest matching prefix decides. Files that match no prefix are kept.
+ * A line with a pattern is an exception to the prefix above it, so it has
+ * to use the opposite action. A pattern is either *SUFFIX, where SUFFIX
+ * may contain '?' to match any one character, or *TEXT* to match TEXT
+ * anywhere in the path.
+ *
+ * Prefixes are kept in a trie that is walked once from the start of the
+ * path. Suffixes are kept in a trie of reversed strings that is walked
+ * from the end of the path. So a decision takes a few character compares
+ * no matter how many rules there are.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "message.h"
+#include "path-filter.h"
+
+struct filter_rule {
+	filter_action_t action;
+	trie_node *suffixes;
+	char **substrings;
+	unsigned int nsubstrings;
+};
+
+/*
+ * These are the rules fapolicyd has always used. Only languages and
+ * private helpers are kept from /usr/share. The kernel sources only
+ * matter for the scripts that akmods run. Headers are never executed.
+ */
+static const char *default_rules[] = {
+	"drop /usr/share/",
+	// These are roughly ordered by quantity
+	"keep /usr/share/ *.py?",	// Python byte code
+	"keep /usr/share/ *.py",	// Python text files
+	"keep /usr/share/ */libexec/*",	// Some apps have a private libexec
+	"keep /usr/share/ *.rb",	// Ruby
+	"keep /usr/share/ *.pl",	// Perl
+	"keep /usr/share/ *.stp",	// System Tap
+	"keep /usr/share/ *.js",	// Javascript
+	"keep /usr/share/ *.jar",	// Java
+	"keep /usr/share/ *.m4",	// M4
+	"keep /usr/share/ *.php",	// PHP
+	"keep /usr/share/ *.pm",	// Perl Modules
+	"keep /usr/share/ *.lua",	// Lua
+	"keep /usr/share/ *.class",	// Java
+	"keep /usr/share/ *.ts",	// Typescript
+	"keep /usr/share/ *.tsx",
+	"keep /usr/share/ *.el",	// Lisp
+	"keep /usr/share/ *.elc",	// Compiled Lisp
+	// Akmod need scripts in /usr/src/kernel
+	"drop /usr/src/",
+	"keep /usr/src/ */scripts/*",
+	"keep /usr/src/ */tools/objtool/*",
+	// Drop anything in /usr/include
+	"drop /usr/include/",
+	NULL
+};
+
+
+void path_filter_init(path_filter_t *f)
+{
+	f->prefixes = NULL;
+	f->rules = 0;
+}
+
+
+// Find or add the child of parent for c
+static trie_node *trie_child(trie_node **children, unsigned char c, int any)
+{
+	trie_node *n;
+
+	for (n = *children; n; n = n->next)
+		if (n->any == any && (any || n->c == c))
+			return n;
+
+	n = calloc(1, sizeof(trie_node));
+	if (n == NULL)
+		return NULL;
+	n->c = c;
+	n->any = any;
+	n->next = *children;
+	*children = n;
+	return n;
+}
+
+
+static void trie_free(trie_node *n)
+{
+	while (n) {
+		trie_node *next = n->next;
+
+		trie_free(n->child);
+		if (n->rule) {
+			unsigned int i;
+
+			trie_free(n->rule->suffixes);
+			for (i = 0; i < n->rule->nsubstrings; i++)
+				free(n->rule->substrings[i]);
+			free(n->rule->substrings);
+			free(n->rule);
+		}
+		free(n);
+		n = next;
+	}
+}
+
+
+// Returns the node for prefix, creating the path to it if needed
+static trie_node *prefix_node(path_filter_t *f, const char *prefix)
+{
+	trie_node **children = &f->prefixes, *n = NULL;
+
+	for (; *prefix; prefix++) {
+		n = trie_child(children, *prefix, 0);
+		if (n == NULL)
+			return NULL;
+		children = &n->child;
+	}
+	return n;
+}
+
+
+// Store suffix reversed. Returns 0 on success and 1 on failure.
+static int add_suffix(struct filter_rule *r, const char *suffix)
+{
+	trie_node **children = &r->suffixes, *n = NULL;
+	size_t i = strlen(suffix);
+
+	while (i--) {
+		n = trie_child(children, suffix[i], suffix[i] == '?');
+		if (n == NULL)
+			return 1;
+		children = &n->child;
+	}
+	n->end = 1;
+	return 0;
+}
+
+
+static int add_substring(struct filter_rule *r, const char *text, size_t len)
+{
+	char **tmp, *s;
+
+	s = strndup(text, len);
+	if (s == NULL)
+		return 1;
+	tmp = realloc(r->substrings,
+		      (r->nsubstrings + 1) * sizeof(char *));
+	if (tmp == NULL) {
+		free(s);
+		return 1;
+	}
+	r->substrings = tmp;
+	r->substrings[r->nsubstrings++] = s;
+	return 0;
+}
+
+
+/*
+ * Add one rule in the format described at the top. Blank lines and
+ * comments are ignored. It returns 0 on success and 1 if the line is
+ * not valid.
+ */
+int path_filter_add(path_filter_t *f, const char *line)
+{
+	char action[8], prefix[4096], pattern[256], extra[2];
+	filter_action_t act;
+	trie_node *n;
+	size_t len;
+	int cnt;
+
+	while (isspace((unsigned char)*line))
+		line++;
+	if (*line == 0 || *line == '#')
+		return 0;
+
+	cnt = sscanf(line, "%7s %4095s %255s %1s", action, prefix, pattern,
+		     extra);
+	if (cnt < 2 || cnt > 3)
+		return 1;
+	if (strcmp(action, "keep") == 0)
+		act = FILTER_KEEP;
+	else if (strcmp(action, "drop") == 0)
+		act = FILTER_DROP;
+	else
+		return 1;
+	if (prefix[0] != '/')
+		return 1;
+
+	n = prefix_node(f, prefix);
+	if (n == NULL)
+		return 1;
+
+	// A prefix on its own
+	if (cnt == 2) {
+		if (n->rule)
+			return 1;
+		n->rule = calloc(1, sizeof(struct filter_rule));
+		if (n->rule == NULL)
+			return 1;
+		n->rule->action = act;
+		f->rules++;
+		return 0;
+	}
+
+	// An exception to the prefix
+	if (n->rule == NULL || n->rule->action == act || pattern[0] != '*')
+		return 1;
+	len = strlen(pattern);
+	if (len > 2 && pattern[len-1] == '*') {
+		if (memchr(pattern + 1, '*', len - 2) ||
+		    memchr(pattern + 1, '?', len - 2))
+			return 1;
+		if (add_substring(n->rule, pattern + 1, len - 2))
+			return 1;
+	} else if (len > 1) {
+		if (strchr(pattern + 1, '*') || add_suffix(n->rule,
+							   pattern + 1))
+			return 1;
+	} else
+		return 1;
+	f->rules++;
+
+	return 0;
+}
+
+
+/*
+ * Load the rules from file. It returns 0 on success, -1 if the file
+ * does not exist, and 1 if it has a bad line. The filter should not be
+ * used after a failure.
+ */
+int path_filter_load(path_filter_t *f, const char *file)
+{
+	char buf[4608];
+	unsigned int lineno = 0;
+	FILE *fp = fopen(file, "re");
+
+	if (fp == NULL)
+		return -1;
+
+	while (fgets(buf, sizeof(buf), fp)) {
+		lineno++;
+		buf[strcspn(buf, "\n")] = 0;
+		if (path_filter_add(f, buf)) {
+			msg(LOG_ERR, "%s:%u: invalid filter rule: %s", file,
+			    lineno, buf);
+			fclose(fp);
+			return 1;
+		}
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+
+void path_filter_load_defaults(path_filter_t *f)
+{
+	unsigned int i;
+
+	for (i = 0; default_rules[i]; i++)
+		path_filter_add(f, default_rules[i]);
+}
+
+
+// Returns 1 if the end of path matches a suffix below children
+static int match_suffix(const trie_node *children, const char *path,
+	size_t pos)
+{
+	const trie_node *n;
+
+	for (n = children; n; n = n->next) {
+		if (!n->any && n->c != (unsigned char)path[pos])
+			continue;
+		if (n->end)
+			return 1;
+		if (pos && match_suffix(n->child, path, pos - 1))
+			return 1;
+	}
+	return 0;
+}
+
+
+// Returns 1 if path should not be in the trust database, 0 otherwise
+int path_filter_drop(const path_filter_t *f, const char *path)
+{
+	const trie_node *children = f->prefixes, *n;
+	const struct filter_rule *rule = NULL;
+	const char *p;
+	size_t len;
+	unsigned int i;
+
+	// Find the longest prefix with a rule
+	for (p = path; *p && children; p++) {
+		for (n = children; n; n = n->next)
+			if (n->c == (unsigned char)*p)
+				break;
+		if (n == NULL)
+			break;
+		if (n->rule)
+			rule = n->rule;
+		children = n->child;
+	}
+	if (rule == NULL)
+		return 0;
+
+	len = strlen(path);
+	if (len && match_suffix(rule->suffixes, path, len - 1))
+		return rule->action != FILTER_DROP;
+	for (i = 0; i < rule->nsubstrings; i++)
+		if (strstr(path, rule->substrings[i]))
+			return rule->action != FILTER_DROP;
+
+	return rule->action == FILTER_DROP;
+}
+
+
+void path_filter_destroy(path_filter_t *f)
+{
+	trie_free(f->prefixes);
+	path_filter_init(f);
+}
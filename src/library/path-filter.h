@@ -0,0 +1,53 @@
+/*
+ * path-filter.h - Header file for the compiled path filter
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef PATH_FILTER_H
+#define PATH_FILTER_H
+
+#define RPM_FILTER_PATH "/etc/fapolicyd/rpm-filter.conf"
+
+typedef enum { FILTER_KEEP, FILTER_DROP } filter_action_t;
+
+struct filter_rule;
+
+// Node of the prefix trie and of the reversed suffix tries
+typedef struct trie_node {
+	unsigned char c;
+	unsigned char any;	// suffix tries: '?' matches any character
+	unsigned char end;	// suffix tries: a suffix ends here
+	struct trie_node *child;
+	struct trie_node *next;
+	struct filter_rule *rule; // prefix trie: rule for this prefix
+} trie_node;
+
+typedef struct path_filter {
+	trie_node *prefixes;
+	unsigned int rules;
+} path_filter_t;
+
+void path_filter_init(path_filter_t *f);
+int path_filter_add(path_filter_t *f, const char *line);
+int path_filter_load(path_filter_t *f, const char *file);
+void path_filter_load_defaults(path_filter_t *f);
+int path_filter_drop(const path_filter_t *f, const char *path);
+void path_filter_destroy(path_filter_t *f);
+
+#endif
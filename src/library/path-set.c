@@ -0,0 +1,113 @@
+/*
+ * path-set.c - Sets of paths to find duplicates
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "path-set.h"
+
+static size_t path_hash(const char *path)
+{
+	uint64_t h = 0xcbf29ce484222325ULL;
+
+	while (*path)
+		h = (h ^ (unsigned char)*path++) * 0x100000001b3ULL;
+	h ^= h >> 32;
+	return (size_t)h;
+}
+
+int path_set_init(struct path_set *set, size_t hint)
+{
+	size_t size = 1024;
+
+	while (size < hint * 2)
+		size <<= 1;
+	set->slots = calloc(size, sizeof(const char *));
+	if (!set->slots)
+		return 1;
+	set->mask = size - 1;
+	set->used = 0;
+	return 0;
+}
+
+void path_set_destroy(struct path_set *set)
+{
+	free(set->slots);
+	set->slots = NULL;
+}
+
+static void path_set_insert(const char **slots, size_t mask, const char *path)
+{
+	size_t i = path_hash(path) & mask;
+
+	while (slots[i])
+		i = (i + 1) & mask;
+	slots[i] = path;
+}
+
+// Returns 1 if path is in the set and 0 otherwise
+int path_set_contains(const struct path_set *set, const char *path)
+{
+	size_t i = path_hash(path) & set->mask;
+
+	while (set->slots[i]) {
+		if (strcmp(set->slots[i], path) == 0)
+			return 1;
+		i = (i + 1) & set->mask;
+	}
+	return 0;
+}
+
+/*
+ * Add path to the set. Returns 0 if it was added, 1 if it was already
+ * there, and -1 if the set could not grow.
+ */
+int path_set_add(struct path_set *set, const char *path)
+{
+	size_t i = path_hash(path) & set->mask;
+
+	while (set->slots[i]) {
+		if (strcmp(set->slots[i], path) == 0)
+			return 1;
+		i = (i + 1) & set->mask;
+	}
+
+	// Keep it at most half full
+	if ((set->used + 1) * 2 > set->mask) {
+		size_t j, size = (set->mask + 1) * 2;
+		const char **slots = calloc(size, sizeof(const char *));
+
+		if (!slots)
+			return -1;
+		for (j = 0; j <= set->mask; j++)
+			if (set->slots[j])
+				path_set_insert(slots, size - 1, set->slots[j]);
+		free(set->slots);
+		set->slots = slots;
+		set->mask = size - 1;
+		path_set_insert(set->slots, set->mask, path);
+	} else
+		set->slots[i] = path;
+	set->used++;
+	return 0;
+}
@@ -0,0 +1,43 @@
+/*
+ * path-set.h - Header file for sets of paths
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef PATH_SET_H
+#define PATH_SET_H
+
+#include <stddef.h>
+
+/*
+ * Set of paths used to find duplicates. The slots point at the strings
+ * that were added, usually the index strings of list items, so those have
+ * to outlive the set.
+ */
+struct path_set {
+	const char **slots;
+	size_t mask;
+	size_t used;
+};
+
+int path_set_init(struct path_set *set, size_t hint);
+void path_set_destroy(struct path_set *set);
+int path_set_contains(const struct path_set *set, const char *path);
+int path_set_add(struct path_set *set, const char *path);
+
+#endif
@@ -419,8 +419,10 @@ void make_policy_decision(const struct fanotify_event_metadata *metadata,
 
 	if (new_event(metadata, &e))
 		decision = FAN_DENY;
-	else
+	else {
 		decision = process_event(&e);
+		release_event(&e);
+	}
 
 	if ((decision & DENY) == DENY)
 		denied++;
@@ -36,19 +36,17 @@
 #include <sys/stat.h>
 #include <magic.h>
 #include "process.h"
+#include "intern.h"
 
 
-struct proc_info *stat_proc_entry(pid_t pid)
+// Fill in the fingerprint of a process. Returns 0 on success, 1 on error.
+int stat_proc_entry(pid_t pid, struct proc_info *info)
 {
 	char path[32];
 	struct stat sb;
 
 	snprintf(path, sizeof(path), "/proc/%d", pid);
 	if (stat(path, &sb) == 0) {
-		struct proc_info *info = malloc(sizeof(struct proc_info));
-		if (info == NULL)
-			return info;
-
 		info->pid = pid;
 		info->device = sb.st_dev;
 		info->inode = sb.st_ino;
@@ -60,16 +58,16 @@ struct proc_info *stat_proc_entry(pid_t pid)
 		info->state = STATE_COLLECTING;
 		info->elf_info = 0;
 
-		return info;
+		return 0;
 	}
-	return NULL;
+	return 1;
 }
 
 
 void clear_proc_info(struct proc_info *info)
 {
-	free(info->path1);
-	free(info->path2);
+	intern_release(info->path1);
+	intern_release(info->path2);
 	info->path1 = NULL;
 	info->path2 = NULL;
 }
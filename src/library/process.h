@@ -69,12 +69,12 @@ struct proc_info
 	ino_t	inode;
 	struct timespec time;
 	state_t state;
-	char *path1;
-	char *path2;
+	const char *path1;	// interned
+	const char *path2;
 	uint32_t elf_info;
 };
 
-struct proc_info *stat_proc_entry(pid_t pid) MALLOCLIKE;
+int stat_proc_entry(pid_t pid, struct proc_info *info);
 void clear_proc_info(struct proc_info *info);
 int compare_proc_infos(const struct proc_info *p1, const struct proc_info *p2);
 char *get_comm_from_pid(pid_t pid, size_t blen, char *buf);
@@ -24,24 +24,29 @@
 
 #include "config.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <sys/types.h>
 #include <rpm/rpmlib.h>
 #include <rpm/rpmts.h>
 #include <rpm/rpmmacro.h>
 #include <rpm/rpmlog.h>
 #include <rpm/rpmdb.h>
-#include <fnmatch.h>
-
-#include <uthash.h>
+#include <rpm/rpmfileutil.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "message.h"
 #include "gcc-attributes.h"
 #include "fapolicyd-backend.h"
 #include "llist.h"
+#include "path-filter.h"
+#include "path-set.h"
 
 static int rpm_init_backend(void);
 static int rpm_load_list(void);
 static int rpm_destroy_backend(void);
+static int rpm_stamp(backend_stamp *st);
+static int rpm_load_changes(list_t *packages, list_t *paths);
 
 backend rpm_backend =
 {
@@ -49,6 +54,8 @@ backend rpm_backend =
 	rpm_init_backend,
 	rpm_load_list,
 	rpm_destroy_backend,
+	rpm_stamp,
+	rpm_load_changes,
 	/* list initialization */
 	{ 0, 0, NULL },
 };
@@ -175,107 +182,145 @@ static void close_rpm(void)
 	rpmlogClose();
 }
 
+static path_filter_t filter;
+
 // This function will check a passed file name to see if the path should
 // be kept or dropped. 1 means discard it, and 0 means keep it.
 static int drop_path(const char *file_name)
 {
-	if (file_name[1] == 'u') {
-		if (file_name[5] == 's') {
-			// Only keep languages from /usr/share
-			if (file_name[6] == 'h' ) {
-				// These are roughly ordered by quantity
-				// Python byte code
-				if (fnmatch("*.py?",
-						 file_name, 0) == 0)
-					return 0;
-				// Python text files
-				else if (fnmatch("*.py",
-						 file_name, 0) == 0)
-					return 0;
-				// Some apps have a private libexec
-				else if (fnmatch("*/libexec/*",
-						file_name, 0) == 0)
-					return 0;
-				// Ruby
-				else if (fnmatch("*.rb",
-						 file_name, 0) == 0)
-					return 0;
-				// Perl
-				else if (fnmatch("*.pl",
-						 file_name, 0) == 0)
-					return 0;
-				// System Tap
-				else if (fnmatch("*.stp",
-						 file_name, 0) == 0)
-					return 0;
-				// Javascript
-				else if (fnmatch("*.js",
-						 file_name, 0) == 0)
-					return 0;
-				// Java
-				else if (fnmatch("*.jar",
-						 file_name, 0) == 0)
-					return 0;
-				// M4
-				else if (fnmatch("*.m4",
-						 file_name, 0) == 0)
-					return 0;
-				// PHP
-				else if (fnmatch("*.php",
-						 file_name, 0) == 0)
-					return 0;
-				// Perl Modules
-				else if (fnmatch("*.pm",
-						 file_name, 0) == 0)
-					return 0;
-				// Lua
-				else if (fnmatch("*.lua",
-						 file_name, 0) == 0)
-					return 0;
-				// Java
-				else if (fnmatch("*.class",
-						 file_name, 0) == 0)
-					return 0;
-				// Typescript
-				else if (fnmatch("*.ts",
-						 file_name, 0) == 0)
-					return 0;
-				else if (fnmatch("*.tsx",
-						 file_name, 0) == 0)
-					return 0;
-				// Lisp
-				else if (fnmatch("*.el",
-						 file_name, 0) == 0)
-					return 0;
-				// Compiled Lisp
-				else if (fnmatch("*.elc",
-						 file_name, 0) == 0)
-					return 0;
-				return 1;
-			// Akmod need scripts in /usr/src/kernel
-			} else if (file_name[6] == 'r' ) {
-				if (fnmatch("*/scripts/*",
-						 file_name, 0) == 0)
-					return 0;
-				else if (fnmatch(
-					"*/tools/objtool/*",
-						 file_name, 0) == 0)
-					return 0;
-				return 1;
-			}
-		// Drop anything in /usr/include
-		} else if (file_name[5] == 'i')
-			return 1;
+	return path_filter_drop(&filter, file_name);
+}
+
+/*
+ * Files owned by several packages, like multilib files, are seen more than
+ * once. Duplicates are found with an open addressing table of hashes that
+ * point at the list entries, so nothing is copied. Entries with the same
+ * hash are compared in full.
+ */
+#define DEDUP_MIN_SLOTS 65536
+
+struct dedup_slot {
+	uint64_t hash;		// 0 means the slot is empty
+	list_item_t *item;
+};
+
+struct dedup_table {
+	struct dedup_slot *slots;
+	size_t mask;
+	size_t used;
+};
+
+static uint64_t dedup_hash(const char *path, const char *data)
+{
+	uint64_t sum = 0xcbf29ce484222325ULL;
+	const unsigned char *p;
+
+	for (p = (const unsigned char *)path; *p; p++)
+		sum = (sum ^ *p) * 0x100000001b3ULL;
+	sum = (sum ^ ' ') * 0x100000001b3ULL;
+	for (p = (const unsigned char *)data; *p; p++)
+		sum = (sum ^ *p) * 0x100000001b3ULL;
+
+	// Mix the high bits down since the low ones pick the slot
+	sum ^= sum >> 33;
+	sum *= 0xff51afd7ed558ccdULL;
+	sum ^= sum >> 33;
+
+	return sum ? sum : 1;
+}
+
+// How many files the last full load kept
+static size_t last_count = 0;
+
+static int dedup_init(struct dedup_table *t, size_t hint)
+{
+	size_t size = DEDUP_MIN_SLOTS;
+
+	while (size < hint * 2)
+		size <<= 1;
+	t->slots = calloc(size, sizeof(struct dedup_slot));
+	if (t->slots == NULL)
+		return 1;
+	t->mask = size - 1;
+	t->used = 0;
+	return 0;
+}
+
+static void dedup_destroy(struct dedup_table *t)
+{
+	free(t->slots);
+	t->slots = NULL;
+}
+
+static int dedup_grow(struct dedup_table *t)
+{
+	size_t i, size = (t->mask + 1) * 2;
+	struct dedup_slot *slots = calloc(size, sizeof(struct dedup_slot));
+
+	if (slots == NULL)
+		return 1;
+
+	for (i = 0; i <= t->mask; i++) {
+		size_t j;
+
+		if (t->slots[i].hash == 0)
+			continue;
+		j = t->slots[i].hash & (size - 1);
+		while (slots[j].hash)
+			j = (j + 1) & (size - 1);
+		slots[j] = t->slots[i];
 	}
+	free(t->slots);
+	t->slots = slots;
+	t->mask = size - 1;
 	return 0;
 }
 
-struct _hash_record {
-	const char * key;
-	UT_hash_handle hh;
-};
+/*
+ * Returns the slot holding path and data, or the empty slot where they
+ * belong. The caller tells an empty slot by item being NULL.
+ */
+static struct dedup_slot *dedup_find(struct dedup_table *t, uint64_t hash,
+	const char *path, const char *data)
+{
+	size_t i = hash & t->mask;
+
+	while (t->slots[i].hash) {
+		const list_item_t *item = t->slots[i].item;
+
+		if (t->slots[i].hash == hash &&
+		    strcmp(item->index, path) == 0 &&
+		    strcmp(item->data, data) == 0)
+			break;
+		i = (i + 1) & t->mask;
+	}
+	return &t->slots[i];
+}
 
 extern int debug;
+
+// Make the trust record of the current file. The caller frees it.
+static char *get_data_rpm(const char *file_name, unsigned int *msg_count)
+{
+	char *data, *sha = get_sha256_rpm();
+
+	if (sha == NULL)
+		return NULL;
+
+	if (strlen(sha) != 64) {
+		// Limit this to 5 if production
+		if (debug || (*msg_count)++ < 5) {
+			msg(LOG_WARNING, "No SHA256 for %s", file_name);
+		}
+	}
+
+	if (asprintf(&data, DATA_FORMAT, (unsigned int)SRC_RPM,
+		     get_file_size_rpm(), sha) == -1)
+		data = NULL;
+	free(sha);
+
+	return data;
+}
 static int rpm_load_list(void)
 {
 	int rc;
@@ -284,8 +329,7 @@ static int rpm_load_list(void)
 	// empty list before loading
 	list_empty(&rpm_backend.list);
 
-	// hash table
-	struct _hash_record *hashtable = NULL;
+	struct dedup_table dedup;
 
 	msg(LOG_INFO, "Loading rpmdb backend");
 	if ((rc = init_rpm())) {
@@ -293,6 +337,13 @@ static int rpm_load_list(void)
 		return rc;
 	}
 
+	// Size the table from the last load, most systems don't change much
+	if (dedup_init(&dedup, last_count)) {
+		msg(LOG_ERR, "Out of memory loading the rpmdb");
+		close_rpm();
+		return 1;
+	}
+
 	// Loop across the rpm database
 	while (get_next_package_rpm()) {
 		// Loop across the packages
@@ -313,49 +364,33 @@ static int rpm_load_list(void)
 
 			// Get specific file information
 			const char *file_name = get_file_name_rpm();
-			rpm_loff_t sz = get_file_size_rpm();
-			const char *sha = get_sha256_rpm();
 			char *data;
-			unsigned int tsource = SRC_RPM;
 
 			if (file_name == NULL)
 				continue;
 
 			if (drop_path(file_name)) {
 				free((void *)file_name);
-				free((void *)sha);
 				continue;
 			}
 
-			if (strlen(sha) != 64) {
-				// Limit this to 5 if production
-				if (debug || msg_count++ < 5) {
-					msg(LOG_WARNING, "No SHA256 for %s",
-							    file_name);
-				}
-			}
-
-			if (asprintf(	&data,
-					DATA_FORMAT,
-					tsource,
-					sz,
-					sha) == -1) {
-				data = NULL;
-			}
-
+			data = get_data_rpm(file_name, &msg_count);
 			if (data) {
 				// getting rid of the duplicates
-				struct _hash_record *rcd = NULL;
-				char key[4096];
-				snprintf(key, 4095, "%s %s", file_name, data);
-
-				HASH_FIND_STR( hashtable, key, rcd );
-
-				if (!rcd) {
-					rcd = (struct _hash_record*) malloc(sizeof(struct _hash_record));
-					rcd->key = strdup(key);
-					HASH_ADD_KEYPTR( hh, hashtable, rcd->key, strlen(rcd->key), rcd );
-					list_append(&rpm_backend.list, file_name, data);
+				uint64_t hash = dedup_hash(file_name, data);
+				struct dedup_slot *slot = dedup_find(&dedup,
+						hash, file_name, data);
+
+				if (slot->item == NULL && list_append(
+					&rpm_backend.list, file_name, data) == 0) {
+					slot->hash = hash;
+					slot->item = rpm_backend.list.last;
+					// Keep the table at most half full
+					if (++dedup.used * 2 > dedup.mask &&
+							dedup_grow(&dedup)) {
+						rc = 1;
+						goto out;
+					}
 				} else {
 					free((void*)file_name);
 					free((void*)data);
@@ -363,31 +398,185 @@ static int rpm_load_list(void)
 			} else {
 				free((void*)file_name);
 			}
-			free((void *)sha);
 		}
 	}
 
+out:
+	close_rpm();
+	dedup_destroy(&dedup);
+	last_count = rpm_backend.list.count;
+	if (rc)
+		msg(LOG_ERR, "Out of memory loading the rpmdb");
+
+	return rc;
+}
+
+/*
+ * Every rpm transaction rewrites the files in the rpmdb directory, so
+ * their metadata tells us if packages could have changed.
+ */
+static int rpm_stamp(backend_stamp *st)
+{
+	char *dbpath;
+	int rc = 1;
+
+	if (init_rpm())
+		goto out;
+
+	dbpath = rpmGetPath("%{_dbpath}", NULL);
+	if (dbpath == NULL)
+		goto out;
+	stamp_dir(st, dbpath);
+	free(dbpath);
+
+	// An empty or missing rpmdb is not something to trust
+	if (st->files < 2)
+		goto out;
+
+	// A new filter changes what gets loaded
+	stamp_path(st, RPM_FILTER_PATH);
+	rc = 0;
+out:
+	// Nothing may load the backend after this, so free the config
 	close_rpm();
+	return rc;
+}
+
+/*
+ * This function loads what an rpm transaction changed. The packages list
+ * holds the name-version-release.arch of the installed packages. The
+ * paths list holds files of erased packages. Every file of the installed
+ * packages is added to paths. Then the records of every package that
+ * still owns one of those paths are loaded into the backend list. Paths
+ * without records afterwards are no longer trusted by rpm. It returns 0
+ * on success and non-zero on error.
+ */
+static int rpm_load_changes(list_t *packages, list_t *paths)
+{
+	int rc;
+	unsigned int msg_count = 0;
+	list_item_t *item;
+	struct path_set seen;
+
+	list_empty(&rpm_backend.list);
+
+	if ((rc = init_rpm())) {
+		msg(LOG_ERR, "init_rpm() failed (%d)", rc);
+		return rc;
+	}
+	if (path_set_init(&seen, paths->count)) {
+		close_rpm();
+		return 1;
+	}
+	for (item = list_get_first(paths); item; item = item->next)
+		if (path_set_add(&seen, item->index) < 0)
+			goto nomem;
+	ts = rpmtsCreate();
+
+	// Every file of the new packages might have changed
+	for (item = list_get_first(packages); item; item = item->next) {
+		mi = rpmtsInitIterator(ts, RPMDBI_LABEL, item->index, 0);
+		if (mi == NULL) {
+			msg(LOG_WARNING, "%s is not installed",
+			    (const char *)item->index);
+			continue;
+		}
+		while ((h = rpmdbNextIterator(mi))) {
+			fi = rpmfiNew(ts, h, RPMTAG_BASENAMES, RPMFI_KEEPHEADER);
+			while (fi && rpmfiNext(fi) >= 0) {
+				const char *fn = rpmfiFN(fi);
+				char *path;
+
+				if (path_set_contains(&seen, fn))
+					continue;
+				path = strdup(fn);
+				if (path && list_append(paths, path, NULL))
+					free(path);
+				else if (path && path_set_add(&seen, path) < 0)
+					goto nomem;
+			}
+			rpmfiFree(fi);
+			fi = NULL;
+		}
+		h = NULL;
+		mi = rpmdbFreeIterator(mi);
+	}
+	path_set_destroy(&seen);
+
+	// Get the records of every package that owns them now
+	for (item = list_get_first(paths); item; item = item->next) {
+		const char *path = item->index;
 
-	// cleaning up
-	struct _hash_record *item, *tmp;
-	HASH_ITER( hh, hashtable, item, tmp) {
-		HASH_DEL( hashtable, item );
-		free((void*)item->key);
-		free((void*)item);
+		mi = rpmtsInitIterator(ts, RPMDBI_INSTFILENAMES, path, 0);
+		if (mi == NULL)
+			continue;
+		while ((h = rpmdbNextIterator(mi))) {
+			int fx;
+			char *name, *data;
+
+			fi = rpmfiNew(ts, h, RPMTAG_BASENAMES, RPMFI_KEEPHEADER);
+			if (fi == NULL)
+				continue;
+			fx = rpmfiFindFN(fi, path);
+			if (fx < 0 || rpmfiSetFX(fi, fx) != fx ||
+			    is_dir_link_rpm() || is_doc_rpm() ||
+			    is_config_rpm() || drop_path(path)) {
+				rpmfiFree(fi);
+				fi = NULL;
+				continue;
+			}
+
+			name = strdup(path);
+			data = get_data_rpm(path, &msg_count);
+			if (!name || !data ||
+			    list_append(&rpm_backend.list, name, data)) {
+				free(name);
+				free(data);
+			}
+			rpmfiFree(fi);
+			fi = NULL;
+		}
+		h = NULL;
+		mi = rpmdbFreeIterator(mi);
 	}
 
+	close_rpm();
+	msg(LOG_DEBUG, "Loaded %ld rpm records for %ld changed paths",
+	    rpm_backend.list.count, paths->count);
+
 	return 0;
+
+nomem:
+	// The iterator owns the header
+	h = NULL;
+	close_rpm();
+	path_set_destroy(&seen);
+	msg(LOG_ERR, "Out of memory loading the rpm changes");
+	return 1;
 }
 
 static int rpm_init_backend(void)
 {
+	int rc;
+
 	list_init(&rpm_backend.list);
+
+	path_filter_init(&filter);
+	rc = path_filter_load(&filter, RPM_FILTER_PATH);
+	if (rc) {
+		if (rc > 0)
+			msg(LOG_ERR, "Using the built-in rpm filter instead");
+		path_filter_destroy(&filter);
+		path_filter_load_defaults(&filter);
+	}
+	msg(LOG_DEBUG, "Loaded %u rpm filter rules", filter.rules);
+
 	return 0;
 }
 
 static int rpm_destroy_backend(void)
 {
 	list_empty(&rpm_backend.list);
+	path_filter_destroy(&filter);
 	return 0;
 }
@@ -1210,7 +1210,7 @@ static int check_subject(lnode *r, event_t *e)
 				break;
 			}
 
-			if (!check_str_attr_set(r->s[cnt].set, subj->str))
+			if (!check_istr_attr_set(r->s[cnt].set, subj->str))
 				return 0;
 
 			break;
@@ -1318,7 +1318,7 @@ static decision_t check_object(lnode *r, event_t *e)
 				break;
 			}
 
-			if (!check_str_attr_set(r->o[cnt].set, obj->o))
+			if (!check_istr_attr_set(r->o[cnt].set, obj->o))
 				return 0;
 
 			break;
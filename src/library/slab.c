@@ -0,0 +1,118 @@
+/*
+ * slab.c - Fixed size object pools
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+ * A slab hands out objects of one size. Memory is taken from malloc a
+ * chunk of objects at a time and freed objects are kept on a list for
+ * reuse, so once the pool has grown to the working set, allocating and
+ * freeing never calls malloc. Chunks are only released by slab_destroy.
+ */
+
+#include <stdlib.h>
+#include <stdalign.h>
+#include <stddef.h>
+
+#include "slab.h"
+
+struct slab_chunk {
+	struct slab_chunk *next;
+	alignas(max_align_t) unsigned char data[];
+};
+
+
+void slab_init(slab_t *s, size_t size, unsigned int per_chunk)
+{
+	size_t align = alignof(max_align_t);
+
+	// A free object holds the pointer to the next free one
+	if (size < sizeof(void *))
+		size = sizeof(void *);
+	s->size = (size + align - 1) & ~(align - 1);
+	s->per_chunk = per_chunk ? per_chunk : 1;
+	s->free = NULL;
+	s->chunks = NULL;
+	s->in_use = 0;
+}
+
+
+// Carve a new chunk into free objects. Returns 0 on success.
+static int slab_grow(slab_t *s)
+{
+	struct slab_chunk *c;
+	unsigned int i;
+
+	c = malloc(sizeof(*c) + s->size * s->per_chunk);
+	if (c == NULL)
+		return 1;
+	c->next = s->chunks;
+	s->chunks = c;
+
+	for (i = 0; i < s->per_chunk; i++) {
+		void **obj = (void **)(c->data + i * s->size);
+
+		*obj = s->free;
+		s->free = obj;
+	}
+	return 0;
+}
+
+
+// Returns an uninitialized object or NULL if out of memory
+void *slab_alloc(slab_t *s)
+{
+	void **obj;
+
+	if (s->free == NULL && slab_grow(s))
+		return NULL;
+
+	obj = s->free;
+	s->free = *obj;
+	s->in_use++;
+	return obj;
+}
+
+
+void slab_free(slab_t *s, void *obj)
+{
+	if (obj == NULL)
+		return;
+
+	*(void **)obj = s->free;
+	s->free = obj;
+	s->in_use--;
+}
+
+
+// Release every chunk. Objects still in use become invalid.
+void slab_destroy(slab_t *s)
+{
+	struct slab_chunk *c = s->chunks;
+
+	while (c) {
+		struct slab_chunk *next = c->next;
+
+		free(c);
+		c = next;
+	}
+	s->chunks = NULL;
+	s->free = NULL;
+	s->in_use = 0;
+}
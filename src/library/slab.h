@@ -0,0 +1,42 @@
+/*
+ * slab.h - Header file for fixed size object pools
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+struct slab_chunk;
+
+typedef struct slab {
+	size_t size;		// bytes per object, rounded for alignment
+	unsigned int per_chunk;	// objects carved from each chunk
+	void *free;		// list of free objects
+	struct slab_chunk *chunks;
+	unsigned long in_use;	// objects handed out
+} slab_t;
+
+void slab_init(slab_t *s, size_t size, unsigned int per_chunk);
+void *slab_alloc(slab_t *s);
+void slab_free(slab_t *s, void *obj);
+void slab_destroy(slab_t *s);
+
+#endif
@@ -41,7 +41,7 @@ typedef struct s {
 	subject_type_t type;
 	union {
 		int val;
-		char *str;
+		const char *str;	// interned
 		size_t gr_index;
 		attr_sets_entry_t * set;
 	};
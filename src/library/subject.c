@@ -28,6 +28,7 @@
 #include <errno.h>
 #include "policy.h"
 #include "subject.h"
+#include "intern.h"
 #include "message.h"
 
 //#define DEBUG
@@ -36,11 +37,10 @@ void subject_create(s_array *a)
 {
 	int i;
 
-	a->subj = malloc(sizeof(subject_attr_t *) * ((SUBJ_END-SUBJ_START)+1));
-	for (i = 0; i < SUBJ_END - SUBJ_START; i++)
+	for (i = 0; i < SUBJ_NUM; i++)
 		a->subj[i] = NULL;
 	a->cnt = 0;
-	a->info = NULL;
+	a->info = &a->proc;
 }
 
 #ifdef DEBUG
@@ -52,7 +52,7 @@ static void sanity_check_array(const s_array *a, const char *id)
 		msg(LOG_DEBUG, "%s - array is NULL", id);
 		abort();
 	}
-	for (i = 0; i < SUBJ_END - SUBJ_START; i++)
+	for (i = 0; i < SUBJ_NUM; i++)
 		if (a->subj[i])
 			num++;
 	if (num != a->cnt) {
@@ -89,9 +89,7 @@ int subject_add(s_array *a, const subject_attr_t *subj)
 		if (t == EXE_DIR)
 			t = EXE;
 		if (t >= SUBJ_START && t <= SUBJ_END) {
-			newnode = malloc(sizeof(subject_attr_t));
-			if (newnode == NULL)
-				return 1;
+			newnode = &a->attr[t - SUBJ_START];
 			newnode->type = t;
 			if (subj->type >= COMM)
 				newnode->str = subj->str;
@@ -129,6 +127,26 @@ subject_attr_t *subject_find_comm(const s_array *a)
 	return NULL;
 }
 
+// Bytes of memory taken by the subject with its share of the strings
+size_t subject_bytes(const s_array *a)
+{
+	size_t bytes = sizeof(s_array) + intern_share(a->info->path1) +
+			intern_share(a->info->path2);
+	int i;
+
+	for (i = 0; i < SUBJ_NUM; i++) {
+		const subject_attr_t *sn = a->subj[i];
+
+		if (sn == NULL)
+			continue;
+		if (sn->type == GID)
+			bytes += attr_set_bytes(sn->set);
+		else if (sn->type >= COMM)
+			bytes += intern_share(sn->str);
+	}
+	return bytes;
+}
+
 void subject_clear(s_array* a)
 {
 	int i;
@@ -138,7 +156,7 @@ void subject_clear(s_array* a)
 		return;
 
 	sanity_check_array(a, "subject_clear");
-	for (i = 0; i < SUBJ_END - SUBJ_START; i++) {
+	for (i = 0; i < SUBJ_NUM; i++) {
 		current = a->subj[i];
 		if (current == NULL)
 			continue;
@@ -146,12 +164,10 @@ void subject_clear(s_array* a)
 			destroy_attr_set(current->set);
 			free(current->set);
 		} else if (current->type >= COMM)
-			free(current->str);
-		free(current);
+			intern_release(current->str);
+		a->subj[i] = NULL;
 	}
 	clear_proc_info(a->info);
-	free(a->info);
-	free(a->subj);
 	a->cnt = 0;
 }
 
@@ -169,8 +185,7 @@ void subject_reset(s_array *a, subject_type_t t)
 			destroy_attr_set(current->set);
 			free(current->set);
 		} else if (current->type >= COMM)
-			free(current->str);
-		free(current);
+			intern_release(current->str);
 		a->subj[t - SUBJ_START] = NULL;
 		a->cnt--;
 		sanity_check_array(a, "subject_reset2");
@@ -28,12 +28,16 @@
 #include "subject-attr.h"
 #include "process.h"
 
+#define SUBJ_NUM (SUBJ_END - SUBJ_START + 1)
+
 /* This is the attribute array. Only data elements that are 1 per
- * event goes here. */
+ * event goes here. Everything is inside, so it is one allocation. */
 typedef struct {
-  subject_attr_t **subj;	// Subject array
+  subject_attr_t *subj[SUBJ_NUM]; // Subject array
   unsigned int cnt;		// How many items in this list
   struct proc_info *info;	// unique proc fingerprint
+  subject_attr_t attr[SUBJ_NUM]; // storage for subj
+  struct proc_info proc;	// storage for info
 } s_array;
 
 void subject_create(s_array *a);
@@ -42,6 +46,7 @@ int subject_add(s_array *a, const subject_attr_t *subj);
 subject_attr_t *subject_find_exe(const s_array *a);
 subject_attr_t *subject_find_comm(const s_array *a);
 void subject_reset(s_array *a, subject_type_t t);
+size_t subject_bytes(const s_array *a);
 void subject_clear(s_array* a);
 static inline int type_is_subj(int type) {if (type < OBJ_START) return 1; else return 0;}
 
@@ -25,20 +25,29 @@
 #include "config.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "fapolicyd-backend.h"
 #include "file.h"
+#include "hash-cache.h"
 #include "llist.h"
 #include "message.h"
+#include "path-set.h"
 #include "trust-file.h"
+#include "trust-index.h"
 
 
 
@@ -49,18 +58,22 @@
 #define FILE_WRITE_FORMAT "%s %lu %s\n"     // path size SHA256
 #define FTW_NOPENFD 1024
 #define FTW_FLAGS (FTW_ACTIONRETVAL | FTW_PHYS)
-
-#define HEADER1 "# This file contains a list of trusted files\n"
-#define HEADER2 "#\n"
-#define HEADER3 "#  FULL PATH        SIZE                             SHA256\n"
-#define HEADER4 "# /home/user/my-ls 157984 61a9960bf7d255a85811f4afcac51067b8f2e4c75e21cf4f2af95319d4ed1b87\n"
-
+#define MAX_LOAD_THREADS 8
 
 
 list_t _list;
 char *_path;
 int _count;
 
+// Trust files being loaded in parallel, each into its own list
+struct trust_part {
+	char *path;
+	list_t list;
+};
+static struct trust_part *_parts;
+static size_t _nparts, _parts_size;
+static atomic_size_t _next_part;
+
 
 
 /**
@@ -70,9 +83,12 @@ int _count;
  * @param count The count variable is used to select which format to use.
  *    non-zero = trust db format, zero = lmdb format.
  *    Writes the size of the path string into the \p count at the end
+ * @param size If not NULL, the number of bytes hashed is written here
+ * @param cached If not NULL, set to 1 if the hash came from the hash cache
  * @return Path string ready to be written to the disk or NULL on error 
  */
-static char *make_path_string(const char *path, int *count)
+static char *make_path_string(const char *path, int *count, off_t *size,
+		int *cached)
 {
 	int fd = open(path, O_RDONLY);
 	if (fd < 0) {
@@ -88,9 +104,24 @@ static char *make_path_string(const char *path, int *count)
 		return NULL;
 	}
 
-	// Get the hash
-	char *hash = get_hash_from_fd(fd);
+	// Get the hash, unless the file did not change since last time
+	char sha[65], *hash;
+	if (hash_cache_lookup(path, &sb, sha)) {
+		hash = strdup(sha);
+		if (cached)
+			*cached = 1;
+	} else {
+		hash = get_hash_from_fd(fd);
+		if (hash)
+			hash_cache_store(path, &sb, hash);
+		if (size)
+			*size = sb.st_size;
+	}
 	close(fd);
+	if (!hash) {
+		msg(LOG_ERR, "Cannot hash %s", path);
+		return NULL;
+	}
 
 	// Format the output
 	char *line;
@@ -106,39 +137,179 @@ static char *make_path_string(const char *path, int *count)
 	return line;
 }
 
+/*
+ * Files are hashed by a pool of threads. Each thread takes the next
+ * path by index and stores its result at the same index, so the output
+ * order does not depend on which thread finishes first.
+ */
+struct hash_job {
+	const char **paths;
+	char **lines;
+	int *counts;
+	size_t n;
+	int trust_format;
+	atomic_size_t next;
+	atomic_size_t done;
+	atomic_size_t cached;
+	atomic_ullong bytes;
+};
+
+static unsigned int _jobs;
+static int _progress;
+
+void trust_file_set_jobs(unsigned int jobs, int progress)
+{
+	_jobs = jobs;
+	_progress = progress;
+}
+
+static void *hash_worker(void *arg)
+{
+	struct hash_job *job = arg;
+	size_t i;
+
+	while ((i = atomic_fetch_add(&job->next, 1)) < job->n) {
+		off_t size = 0;
+		int cached = 0;
+
+		job->counts[i] = job->trust_format;
+		job->lines[i] = make_path_string(job->paths[i],
+					&job->counts[i], &size, &cached);
+		atomic_fetch_add(&job->bytes, size);
+		atomic_fetch_add(&job->cached, cached);
+		atomic_fetch_add(&job->done, 1);
+	}
+	return NULL;
+}
+
+static double elapsed_since(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) +
+		(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void show_progress(struct hash_job *job, const struct timespec *start,
+		int last)
+{
+	double secs = elapsed_since(start);
+	double mb = atomic_load(&job->bytes) / (1024.0 * 1024.0);
+
+	fprintf(stderr,
+		"\rHashed %zu of %zu files, %zu unchanged, %.1f MB, %.1f MB/s%s",
+		atomic_load(&job->done), job->n, atomic_load(&job->cached),
+		mb, secs > 0 ? mb / secs : 0.0, last ? "\n" : "");
+}
+
+/*
+ * Hash every path. lines[i] gets the string for paths[i], or NULL on
+ * error, and counts[i] its length as make_path_string describes.
+ */
+static void hash_paths(const char **paths, char **lines, int *counts,
+		size_t n, int trust_format)
+{
+	struct hash_job job = { paths, lines, counts, n, trust_format,
+				0, 0, 0, 0 };
+	pthread_t *threads;
+	size_t i, nthreads = 0, wanted = _jobs;
+	struct timespec start;
+
+	if (n == 0)
+		return;
+
+	if (wanted == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		wanted = cpus > 0 ? (size_t)cpus : 1;
+	}
+	if (wanted > n)
+		wanted = n;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	threads = malloc(wanted * sizeof(pthread_t));
+	if (threads) {
+		for (i = 0; i < wanted; i++) {
+			if (pthread_create(&threads[nthreads], NULL,
+					   hash_worker, &job))
+				break;
+			nthreads++;
+		}
+	}
+
+	if (nthreads == 0)
+		hash_worker(&job);
+	else if (_progress) {
+		const struct timespec tick = { 0, 500000000 };
+
+		while (atomic_load(&job.done) < n) {
+			nanosleep(&tick, NULL);
+			show_progress(&job, &start, 0);
+		}
+	}
+
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	if (_progress)
+		show_progress(&job, &start, 1);
+}
+
 /**
- * Write a list into a file
+ * Create a temporary file in the directory of \p dest with the owner and
+ * mode of \p dest. It is renamed over \p dest by commit_temp, so readers
+ * see either the old or the new file, never a partial one.
  *
- * @param list List to write into a file
  * @param dest Destination file
- * @return 0 on success, 1 on error
+ * @param tmp Receives the path of the temporary file
+ * @param size Size of \p tmp
+ * @return Stream to write to, or NULL on error
  */
-static int write_out_list(list_t *list, const char *dest)
+static FILE *open_temp(const char *dest, char *tmp, size_t size)
 {
-	FILE *f = fopen(dest, "w");
-	if (!f) {
-		msg(LOG_ERR, "Cannot delete %s", dest);
-		list_empty(list);
-		return 1;
+	struct stat sb;
+	int fd;
+
+	if (snprintf(tmp, size, "%s.XXXXXX", dest) >= (int)size
+	    || (fd = mkostemp(tmp, O_CLOEXEC)) < 0) {
+		msg(LOG_ERR, "Cannot write %s", dest);
+		return NULL;
 	}
 
-	size_t hlen = strlen(HEADER1);
-	fwrite(HEADER1, hlen, 1, f);
-	hlen = strlen(HEADER2);
-	fwrite(HEADER2, hlen, 1, f);
-	hlen = strlen(HEADER3);
-	fwrite(HEADER3, hlen, 1, f);
-	hlen = strlen(HEADER4);
-	fwrite(HEADER4, hlen, 1, f);
+	// Keep the owner and mode of the file being replaced
+	if (stat(dest, &sb) == 0) {
+		if (fchown(fd, sb.st_uid, sb.st_gid))
+			msg(LOG_WARNING, "Cannot set owner of %s", dest);
+		fchmod(fd, sb.st_mode & 07777);
+	} else
+		fchmod(fd, 0644);
 
-	for (list_item_t *lptr = list->first; lptr; lptr = lptr->next) {
-		char buf[BUFFER_SIZE + 1];
-		char *str = (char *)(lptr->data);
-		hlen = snprintf(buf, sizeof(buf), "%s %s\n", (char *)lptr->index, str + 2);
-		fwrite(buf, hlen, 1, f);
+	FILE *f = fdopen(fd, "w");
+	if (!f) {
+		msg(LOG_ERR, "Cannot write %s", dest);
+		close(fd);
+		unlink(tmp);
 	}
+	return f;
+}
 
+// Flush the temporary file and rename it over dest. Returns 0 on success.
+static int commit_temp(FILE *f, const char *tmp, const char *dest)
+{
+	if (fflush(f) || fsync(fileno(f)) || ferror(f)) {
+		msg(LOG_ERR, "Cannot write %s", dest);
+		fclose(f);
+		unlink(tmp);
+		return 1;
+	}
 	fclose(f);
+
+	if (rename(tmp, dest)) {
+		msg(LOG_ERR, "Cannot replace %s", dest);
+		unlink(tmp);
+		return 1;
+	}
 	return 0;
 }
 
@@ -151,136 +322,430 @@ int trust_file_append(const char *fpath, const list_t *list) {
 		return 1;
 	}
 
-	for (list_item_t *lptr = list->first; lptr; lptr = lptr->next) {
-		int count = 1;
-		char *line = make_path_string(lptr->index, &count);
-		if (!line)
+	size_t i, n = list->count;
+	const char **paths = malloc(n * sizeof(char *));
+	char **lines = calloc(n, sizeof(char *));
+	int *counts = malloc(n * sizeof(int));
+	int rc = 0;
+
+	if (n && (!paths || !lines || !counts)) {
+		msg(LOG_ERR, "Out of memory");
+		rc = 1;
+		goto out;
+	}
+
+	i = 0;
+	for (list_item_t *lptr = list->first; lptr; lptr = lptr->next)
+		paths[i++] = lptr->index;
+	hash_paths(paths, lines, counts, n, 1);
+
+	for (i = 0; i < n; i++) {
+		if (!lines[i])
 			continue;
 
-		if (write(fd, line, count) == -1) {
+		if (write(fd, lines[i], counts[i]) == -1) {
 			msg(LOG_ERR, "failed writing to %s\n", fpath);
-			free(line);
-			close(fd);
-			return 2;
+			rc = 2;
+			break;
 		}
-		free(line);
 	}
 
+out:
+	if (lines)
+		for (i = 0; i < n; i++)
+			free(lines[i]);
+	free(paths);
+	free(lines);
+	free(counts);
 	close(fd);
+	return rc;
+}
+
+static inline const char *skip_blanks(const char *p, const char *end)
+{
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+	return p;
+}
+
+static inline const char *skip_word(const char *p, const char *end)
+{
+	while (p < end && !isspace((unsigned char)*p))
+		p++;
+	return p;
+}
+
+/*
+ * Parse one "path size sha256" line that ends before end. It returns 0
+ * on success and 1 if the line does not have all three fields.
+ */
+static int parse_trust_line(const char *line, const char *end,
+		const char **name, size_t *name_len, unsigned long *sz,
+		const char **sha, size_t *sha_len)
+{
+	const char *p = skip_blanks(line, end), *num;
+
+	*name = p;
+	p = skip_word(p, end);
+	*name_len = p - *name;
+	if (*name_len == 0 || *name_len > 4096)
+		return 1;
+
+	p = skip_blanks(p, end);
+	num = p;
+	*sz = 0;
+	while (p < end && *p >= '0' && *p <= '9')
+		*sz = *sz * 10 + (*p++ - '0');
+	if (p == num || (p < end && !isspace((unsigned char)*p)))
+		return 1;
+
+	p = skip_blanks(p, end);
+	*sha = p;
+	p = skip_word(p, end);
+	*sha_len = p - *sha;
+	if (*sha_len == 0 || *sha_len > 64)
+		return 1;
+
 	return 0;
 }
 
-int trust_file_load(const char *fpath, list_t *list)
+/*
+ * Read a trust file into memory. The file is read rather than mapped
+ * because it can be truncated while we look at it, and touching a mapped
+ * page past the new end kills the process. An empty file gives a NULL
+ * buffer. It returns 0 on success and 1 on error.
+ */
+int read_trust_file(const char *fpath, const char **map, size_t *size)
 {
-	FILE *file = fopen(fpath, "r");
-	if (!file) {
+	int fd = open(fpath, O_RDONLY|O_CLOEXEC);
+	if (fd < 0) {
 		msg(LOG_ERR, "Cannot open %s", fpath);
 		return 1;
 	}
 
-	char buffer[BUFFER_SIZE];
-	while (fgets(buffer, BUFFER_SIZE, file)) {
-		char name[4097], sha[65], *index, *data;
-		unsigned long sz;
-		unsigned int tsource = SRC_FILE_DB;
+	struct stat sb;
+	if (fstat(fd, &sb)) {
+		msg(LOG_ERR, "Cannot stat %s", fpath);
+		close(fd);
+		return 1;
+	}
+	*map = NULL;
+	*size = 0;
+	if (sb.st_size == 0) {
+		close(fd);
+		return 0;
+	}
 
-		if (iscntrl(buffer[0]) || buffer[0] == '#')
-			continue;
+	char *buf = malloc(sb.st_size);
+	if (buf == NULL) {
+		msg(LOG_ERR, "Out of memory reading %s", fpath);
+		close(fd);
+		return 1;
+	}
 
-		if (sscanf(buffer, FILE_READ_FORMAT, name, &sz, sha) != 3) {
-			msg(LOG_WARNING, "Can't parse %s", buffer);
-			fclose(file);
-			return 2;
+	// A file that shrank meanwhile is simply shorter
+	size_t len = 0;
+	while (len < (size_t)sb.st_size) {
+		ssize_t rc = read(fd, buf + len, sb.st_size - len);
+
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0) {
+			msg(LOG_ERR, "Cannot read %s", fpath);
+			free(buf);
+			close(fd);
+			return 1;
 		}
+		if (rc == 0)
+			break;
+		len += rc;
+	}
+	close(fd);
 
-		if (asprintf(&data, DATA_FORMAT, tsource, sz, sha) == -1)
-			data = NULL;
+	if (len == 0) {
+		free(buf);
+		return 0;
+	}
+	*map = buf;
+	*size = len;
+	return 0;
+}
 
-		index = strdup(name);
+int trust_file_load(const char *fpath, list_t *list)
+{
+	const char *map;
+	size_t size;
+
+	if (read_trust_file(fpath, &map, &size))
+		return 1;
+	if (map == NULL)
+		return 0;
+
+	// Entries already in the list count as duplicates too
+	struct path_set seen;
+	if (path_set_init(&seen, list->count + size / 100)) {
+		free((void *)map);
+		return 1;
+	}
+	for (list_item_t *lptr = list->first; lptr; lptr = lptr->next)
+		path_set_add(&seen, lptr->index);
+
+	int rc = 0;
+	const char *line = map, *eof = map + size;
+	while (line < eof) {
+		const char *end = memchr(line, '\n', eof - line), *name, *sha;
+		size_t name_len, sha_len;
+		unsigned long sz;
+		char *index, *data, buf[80];
+		int len;
+
+		if (!end)
+			end = eof;
 
+		if (iscntrl((unsigned char)line[0]) || line[0] == '#')
+			goto next;
+
+		if (parse_trust_line(line, end, &name, &name_len, &sz,
+				     &sha, &sha_len)) {
+			msg(LOG_WARNING, "Can't parse %.*s", (int)(end - line),
+			    line);
+			rc = 2;
+			break;
+		}
+
+		// This is DATA_FORMAT without the hash, which is copied after
+		len = snprintf(buf, sizeof(buf), "%u %lu ",
+			       (unsigned int)SRC_FILE_DB, sz);
+		index = malloc(name_len + 1);
+		data = malloc(len + sha_len + 1);
 		if (!index || !data) {
 			free(index);
 			free(data);
-			continue;
+			goto next;
 		}
+		memcpy(index, name, name_len);
+		index[name_len] = 0;
+		memcpy(data, buf, len);
+		memcpy(data + len, sha, sha_len);
+		data[len + sha_len] = 0;
 
-		if (list_contains(list, index)) {
+		if (path_set_contains(&seen, index)) {
 			msg(LOG_WARNING, "%s contains a duplicate %s", fpath, index);
 			free(index);
 			free(data);
-			continue;
+			goto next;
 		}
 
+		// The set points at index, so only add what the list owns
 		if (list_append(list, index, data)) {
 			free(index);
 			free(data);
+		} else
+			path_set_add(&seen, index);
+next:
+		line = end + 1;
+	}
+
+	path_set_destroy(&seen);
+	free((void *)map);
+	return rc;
+}
+
+// A line of a loaded trust file whose path matched
+struct trust_match {
+	const char *line;	// start of the line
+	const char *end;	// its newline, or the end of the map
+	char *path;		// copy of the path, if asked for
+	unsigned long size;
+	const char *sha;
+	size_t sha_len;
+};
+
+static void free_matches(struct trust_match *m, long n)
+{
+	long i;
+
+	for (i = 0; i < n; i++)
+		free(m[i].path);
+	free(m);
+}
+
+/*
+ * Find the lines of a loaded trust file whose path starts with prefix.
+ * Lines that can't be parsed are left alone. It returns the number of
+ * matches, or -1 if out of memory.
+ */
+static long find_matches(const char *map, size_t size, const char *prefix,
+		int copy_paths, struct trust_match **out)
+{
+	const char *line = map, *eof = map + size;
+	size_t prefix_len = strlen(prefix), msize = 0;
+	struct trust_match *m = NULL;
+	long n = 0;
+
+	while (line < eof) {
+		const char *end = memchr(line, '\n', eof - line), *name;
+		size_t name_len;
+
+		if (!end)
+			end = eof;
+
+		if (iscntrl((unsigned char)line[0]) || line[0] == '#')
+			goto next;
+
+		struct trust_match cur = { line, end, NULL, 0, NULL, 0 };
+		if (parse_trust_line(line, end, &name, &name_len, &cur.size,
+				     &cur.sha, &cur.sha_len) ||
+		    name_len < prefix_len || memcmp(name, prefix, prefix_len))
+			goto next;
+
+		if ((size_t)n == msize) {
+			size_t grow = msize ? msize * 2 : 16;
+			struct trust_match *tmp = realloc(m,
+							  grow * sizeof(*m));
+			if (!tmp)
+				goto oom;
+			m = tmp;
+			msize = grow;
 		}
+		if (copy_paths && !(cur.path = strndup(name, name_len)))
+			goto oom;
+		m[n++] = cur;
+next:
+		line = end + 1;
 	}
 
-	fclose(file);
-	return 0;
+	*out = m;
+	return n;
+oom:
+	free_matches(m, n);
+	*out = NULL;
+	return -1;
 }
 
-int trust_file_delete_path(const char *fpath, const char *path)
+/*
+ * Stream a loaded trust file into a temporary file and rename it over
+ * dest. Matched lines are dropped if repl is NULL. Otherwise a matched
+ * line is replaced by repl[i], or kept if repl[i] is NULL. Everything
+ * else, including comments, is copied as it is.
+ */
+static int write_out_edited(const char *dest, const char *map, size_t size,
+		const struct trust_match *m, long n, char **repl)
 {
-	list_t list;
-	list_init(&list);
-	trust_file_load(fpath, &list);
-
-	int count = 0;
-	size_t path_len = strlen(path);
-	list_item_t *lptr = list.first, *prev = NULL, *tmp;
-
-	while (lptr) {
-		if (!strncmp(lptr->index, path, path_len)) {
-			++count;
-			tmp = lptr->next;
-
-			if (prev)
-				prev->next = lptr->next;
-			else
-				list.first = lptr->next;
-			if (!lptr->next)
-				list.last = prev;
-			--list.count;
-			list_destroy_item(&lptr);
-
-			lptr = tmp;
+	const char *pos = map, *eof = map + size;
+	char tmp[PATH_MAX];
+	long i;
+
+	FILE *f = open_temp(dest, tmp, sizeof(tmp));
+	if (!f)
+		return 1;
+
+	for (i = 0; i < n; i++) {
+		fwrite(pos, m[i].line - pos, 1, f);
+		pos = m[i].end < eof ? m[i].end + 1 : eof;
+		if (!repl)
 			continue;
-		}
-		prev = lptr;
-		lptr = lptr->next;
+		if (repl[i])
+			fputs(repl[i], f);
+		else
+			fwrite(m[i].line, pos - m[i].line, 1, f);
 	}
+	fwrite(pos, eof - pos, 1, f);
 
-	if (count)
-		write_out_list(&list, fpath);
+	return commit_temp(f, tmp, dest);
+}
 
-	list_empty(&list);
+int trust_file_delete_path(const char *fpath, const char *path)
+{
+	struct trust_match *m;
+	const char *map;
+	size_t size;
+	long count;
+
+	if (read_trust_file(fpath, &map, &size) || map == NULL)
+		return 0;
+
+	count = find_matches(map, size, path, 0, &m);
+	if (count < 0) {
+		msg(LOG_ERR, "Out of memory");
+		count = 0;
+	} else if (count)
+		write_out_edited(fpath, map, size, m, count, NULL);
+
+	free_matches(m, count);
+	free((void *)map);
 	return count;
 }
 
+// Compare the size and hash of a matched entry with a new trust file line
+static int same_entry(const struct trust_match *m, const char *line)
+{
+	const char *name, *sha;
+	size_t name_len, sha_len;
+	unsigned long size;
+
+	if (parse_trust_line(line, line + strlen(line), &name, &name_len,
+			     &size, &sha, &sha_len))
+		return 0;
+	return size == m->size && sha_len == m->sha_len &&
+		memcmp(sha, m->sha, sha_len) == 0;
+}
+
 int trust_file_update_path(const char *fpath, const char *path)
 {
-	list_t list;
-	list_init(&list);
-	trust_file_load(fpath, &list);
-
-	int count = 0;
-	size_t path_len = strlen(path);
-
-	for (list_item_t *lptr = list.first; lptr; lptr = lptr->next) {
-		if (!strncmp(lptr->index, path, path_len)) {
-			int i = 0;
-			free((char *)lptr->data);
-			lptr->data = make_path_string(lptr->index, &i);
-			++count;
+	struct trust_match *m;
+	const char *map;
+	size_t size;
+	long count, i;
+	int changed = 0;
+
+	if (read_trust_file(fpath, &map, &size) || map == NULL)
+		return 0;
+
+	count = find_matches(map, size, path, 1, &m);
+	if (count > 0) {
+		const char **paths = malloc(count * sizeof(char *));
+		char **lines = calloc(count, sizeof(char *));
+		int *counts = malloc(count * sizeof(int));
+
+		if (!paths || !lines || !counts) {
+			msg(LOG_ERR, "Out of memory");
+			free(paths);
+			free(lines);
+			free(counts);
+			free_matches(m, count);
+			free((void *)map);
+			return 0;
+		}
+
+		for (i = 0; i < count; i++)
+			paths[i] = m[i].path;
+		hash_paths(paths, lines, counts, count, 1);
+
+		// Files that can't be hashed or did not change keep their line
+		for (i = 0; i < count; i++) {
+			if (lines[i] && same_entry(&m[i], lines[i])) {
+				free(lines[i]);
+				lines[i] = NULL;
+			} else if (lines[i])
+				changed++;
 		}
-	}
 
-	if (count)
-		write_out_list(&list, fpath);
+		if (changed)
+			write_out_edited(fpath, map, size, m, count, lines);
+
+		for (i = 0; i < count; i++)
+			free(lines[i]);
+		free(paths);
+		free(lines);
+		free(counts);
+	} else if (count < 0) {
+		msg(LOG_ERR, "Out of memory");
+		count = 0;
+	}
 
-	list_empty(&list);
+	free_matches(m, count);
+	free((void *)map);
 	return count;
 }
 
@@ -317,13 +782,28 @@ int trust_file_rm_duplicates(const char *fpath, list_t *list)
 
 
 
-static int ftw_load(const char *fpath,
+static int ftw_collect(const char *fpath,
 		const struct stat *sb __attribute__ ((unused)),
 		int typeflag,
 		struct FTW *ftwbuf __attribute__ ((unused)))
 {
-	if (typeflag == FTW_F)
-		trust_file_load(fpath, &_list);
+	if (typeflag != FTW_F)
+		return FTW_CONTINUE;
+
+	if (_nparts == _parts_size) {
+		size_t size = _parts_size ? _parts_size * 2 : 16;
+		struct trust_part *tmp = realloc(_parts, size * sizeof(*tmp));
+		if (!tmp)
+			return FTW_STOP;
+		_parts = tmp;
+		_parts_size = size;
+	}
+
+	_parts[_nparts].path = strdup(fpath);
+	if (!_parts[_nparts].path)
+		return FTW_STOP;
+	list_init(&_parts[_nparts].list);
+	_nparts++;
 	return FTW_CONTINUE;
 }
 
@@ -361,30 +841,148 @@ static int ftw_rm_duplicates(const char *fpath,
 
 
 
+static int part_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct trust_part *)a)->path,
+		      ((const struct trust_part *)b)->path);
+}
+
+static void *load_worker(void *arg __attribute__ ((unused)))
+{
+	size_t i;
+
+	while ((i = atomic_fetch_add(&_next_part, 1)) < _nparts)
+		trust_file_load(_parts[i].path, &_parts[i].list);
+	return NULL;
+}
+
+/*
+ * Move the items of src to the end of dest. Items whose path is already
+ * in seen are dropped, so the file that comes first wins.
+ */
+static void merge_part(list_t *dest, struct trust_part *part,
+		struct path_set *seen)
+{
+	list_item_t *item = part->list.first, *next;
+
+	for (; item; item = next) {
+		next = item->next;
+		if (path_set_add(seen, item->index) > 0) {
+			msg(LOG_WARNING, "%s contains a duplicate %s",
+			    part->path, (const char *)item->index);
+			list_destroy_item(&item);
+			continue;
+		}
+		item->next = NULL;
+		if (dest->last)
+			dest->last->next = item;
+		else
+			dest->first = item;
+		dest->last = item;
+		dest->count++;
+	}
+	list_init(&part->list);
+}
+
+/*
+ * Load fapolicyd.trust and every file in trust.d. The files are parsed
+ * in parallel and then merged in a fixed order: fapolicyd.trust first,
+ * then the trust.d files sorted by path.
+ */
 void trust_file_load_all(list_t *list)
 {
+	pthread_t threads[MAX_LOAD_THREADS];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t i, nthreads = 0, wanted;
+
 	list_empty(&_list);
-	trust_file_load(TRUST_FILE_PATH, &_list);
-	nftw(TRUST_DIR_PATH, &ftw_load, FTW_NOPENFD, FTW_FLAGS);
+	_nparts = 0;
+	ftw_collect(TRUST_FILE_PATH, NULL, FTW_F, NULL);
+	nftw(TRUST_DIR_PATH, &ftw_collect, FTW_NOPENFD, FTW_FLAGS);
+	if (_nparts > 1)
+		qsort(&_parts[1], _nparts - 1, sizeof(*_parts), part_cmp);
+
+	wanted = cpus > 0 ? (size_t)cpus : 1;
+	if (wanted > MAX_LOAD_THREADS)
+		wanted = MAX_LOAD_THREADS;
+	if (wanted > _nparts)
+		wanted = _nparts;
+
+	atomic_store(&_next_part, 0);
+	for (i = 1; i < wanted; i++) {
+		if (pthread_create(&threads[nthreads], NULL, load_worker, NULL))
+			break;
+		nthreads++;
+	}
+	// This thread works too, and does everything if no thread started
+	load_worker(NULL);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+
+	size_t total = 0;
+	for (i = 0; i < _nparts; i++)
+		total += _parts[i].list.count;
+
+	struct path_set seen;
+	int have_set = path_set_init(&seen, total) == 0;
+	for (i = 0; i < _nparts; i++) {
+		if (have_set)
+			merge_part(&_list, &_parts[i], &seen);
+		else
+			list_merge(&_list, &_parts[i].list);
+		free(_parts[i].path);
+	}
+	if (have_set)
+		path_set_destroy(&seen);
+	free(_parts);
+	_parts = NULL;
+	_nparts = _parts_size = 0;
+
 	list_merge(list, &_list);
 }
 
-int trust_file_delete_path_all(const char *path)
+/*
+ * Run fn on the trust files that the index says may hold path. If the
+ * index can't be used, every trust file is walked instead.
+ */
+static int for_indexed_files(const char *path,
+		int (*fn)(const char *fpath, const char *path),
+		int (*ftw_fn)(const char *, const struct stat *, int,
+			      struct FTW *))
 {
-	_path = strdup(path);
-	_count = trust_file_delete_path(TRUST_FILE_PATH, path);
-	nftw(TRUST_DIR_PATH, &ftw_delete_path, FTW_NOPENFD, FTW_FLAGS);
-	free(_path);
+	char **files;
+	size_t i, n;
+
+	if (trust_index_files(TRUST_INDEX_PATH, path, &files, &n)) {
+		trust_index_close(TRUST_INDEX_PATH);
+		_path = strdup(path);
+		_count = fn(TRUST_FILE_PATH, path);
+		nftw(TRUST_DIR_PATH, ftw_fn, FTW_NOPENFD, FTW_FLAGS);
+		free(_path);
+		return _count;
+	}
+
+	_count = 0;
+	for (i = 0; i < n; i++) {
+		_count += fn(files[i], path);
+		trust_index_touch(files[i]);
+		free(files[i]);
+	}
+	free(files);
+	trust_index_close(TRUST_INDEX_PATH);
 	return _count;
 }
 
+int trust_file_delete_path_all(const char *path)
+{
+	return for_indexed_files(path, trust_file_delete_path,
+				 ftw_delete_path);
+}
+
 int trust_file_update_path_all(const char *path)
 {
-	_path = strdup(path);
-	_count = trust_file_update_path(TRUST_FILE_PATH, path);
-	nftw(TRUST_DIR_PATH, &ftw_update_path, FTW_NOPENFD, FTW_FLAGS);
-	free(_path);
-	return _count;
+	return for_indexed_files(path, trust_file_update_path,
+				 ftw_update_path);
 }
 
 void trust_file_rm_duplicates_all(list_t *list)
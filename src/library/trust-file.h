@@ -30,9 +30,13 @@
 #define TRUST_FILE_PATH "/etc/fapolicyd/fapolicyd.trust"
 #define TRUST_DIR_PATH "/etc/fapolicyd/trust.d/"
 
+// Hash with jobs threads, 0 means one per CPU. Show progress on stderr.
+void trust_file_set_jobs(unsigned int jobs, int progress);
+
 int trust_file_append(const char *fpath, const list_t *list);
 
 int trust_file_load(const char *fpath, list_t *list);
+int read_trust_file(const char *fpath, const char **map, size_t *size);
 int trust_file_update_path(const char *fpath, const char *path);
 int trust_file_delete_path(const char *fpath, const char *path);
 int trust_file_rm_duplicates(const char *fpath, list_t *list);
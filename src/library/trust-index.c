@@ -0,0 +1,466 @@
+/*
+ * trust-index.c - Find the trust files that hold a path
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+ * The index records the directories that each trust file has entries in.
+ * A trust file can only hold entries starting with a path if one of its
+ * directories starts with the path or the path starts with the directory.
+ * Each trust file is stamped with its device, inode, size and mtime. A
+ * file whose stamp changed is scanned again the next time the index is
+ * used, so the index is only rebuilt for what changed.
+ */
+
+#include "config.h"
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "message.h"
+#include "trust-file.h"
+#include "trust-index.h"
+
+#define INDEX_HEADER "# fapolicyd trust file index 1\n"
+#define FTW_NOPENFD 1024
+#define FTW_FLAGS (FTW_ACTIONRETVAL | FTW_PHYS)
+
+struct indexed_file {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	char **dirs;		// sorted, each ends with '/'
+	size_t ndirs;
+	int seen;
+};
+
+static struct indexed_file *files;
+static size_t nfiles, files_size;
+static int loaded, dirty;
+
+
+static void free_dirs(struct indexed_file *f)
+{
+	size_t i;
+
+	for (i = 0; i < f->ndirs; i++)
+		free(f->dirs[i]);
+	free(f->dirs);
+	f->dirs = NULL;
+	f->ndirs = 0;
+}
+
+
+static void remove_file(size_t i)
+{
+	free_dirs(&files[i]);
+	free(files[i].path);
+	nfiles--;
+	memmove(&files[i], &files[i + 1], (nfiles - i) * sizeof(*files));
+	dirty = 1;
+}
+
+
+static struct indexed_file *find_file(const char *path)
+{
+	size_t i;
+
+	for (i = 0; i < nfiles; i++)
+		if (strcmp(files[i].path, path) == 0)
+			return &files[i];
+	return NULL;
+}
+
+
+static struct indexed_file *add_file(const char *path)
+{
+	struct indexed_file *f;
+
+	if (nfiles == files_size) {
+		size_t size = files_size ? files_size * 2 : 64;
+		f = realloc(files, size * sizeof(*f));
+		if (f == NULL)
+			return NULL;
+		files = f;
+		files_size = size;
+	}
+
+	f = &files[nfiles];
+	memset(f, 0, sizeof(*f));
+	f->path = strdup(path);
+	if (f->path == NULL)
+		return NULL;
+	nfiles++;
+	return f;
+}
+
+
+static int add_dir(struct indexed_file *f, const char *dir, size_t len)
+{
+	char **tmp, *d;
+
+	// Entries of a directory are usually together
+	if (f->ndirs && strncmp(f->dirs[f->ndirs - 1], dir, len) == 0 &&
+	    f->dirs[f->ndirs - 1][len] == 0)
+		return 0;
+
+	d = strndup(dir, len);
+	if (d == NULL)
+		return 1;
+	tmp = realloc(f->dirs, (f->ndirs + 1) * sizeof(char *));
+	if (tmp == NULL) {
+		free(d);
+		return 1;
+	}
+	f->dirs = tmp;
+	f->dirs[f->ndirs++] = d;
+	return 0;
+}
+
+
+static int str_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+static void sort_dirs(struct indexed_file *f)
+{
+	size_t i, j;
+
+	if (f->ndirs < 2)
+		return;
+	qsort(f->dirs, f->ndirs, sizeof(char *), str_cmp);
+	for (i = 1, j = 0; i < f->ndirs; i++) {
+		if (strcmp(f->dirs[i], f->dirs[j]) == 0)
+			free(f->dirs[i]);
+		else
+			f->dirs[++j] = f->dirs[i];
+	}
+	f->ndirs = j + 1;
+}
+
+
+// Read the directories of every entry in a trust file
+static int scan_file(struct indexed_file *f, const struct stat *sb)
+{
+	const char *map, *line, *eof;
+	size_t size;
+
+	free_dirs(f);
+	f->dev = sb->st_dev;
+	f->ino = sb->st_ino;
+	f->size = sb->st_size;
+	f->mtime = sb->st_mtim;
+	dirty = 1;
+	if (sb->st_size == 0)
+		return 0;
+
+	if (read_trust_file(f->path, &map, &size))
+		return 1;
+	if (map == NULL)
+		return 0;
+
+	eof = map + size;
+	for (line = map; line < eof; ) {
+		const char *end = memchr(line, '\n', eof - line), *p, *slash;
+
+		if (end == NULL)
+			end = eof;
+		p = line;
+		while (p < end && (*p == ' ' || *p == '\t'))
+			p++;
+
+		// Comments and blank lines don't start with '/'
+		if (p < end && *p == '/') {
+			const char *start = p;
+
+			for (slash = p; p < end && !isspace((unsigned char)*p);
+			     p++)
+				if (*p == '/')
+					slash = p;
+			if (add_dir(f, start, slash - start + 1)) {
+				free((void *)map);
+				return 1;
+			}
+		}
+		line = end + 1;
+	}
+	free((void *)map);
+	sort_dirs(f);
+
+	return 0;
+}
+
+
+static int same_stamp(const struct indexed_file *f, const struct stat *sb)
+{
+	return f->dev == sb->st_dev && f->ino == sb->st_ino &&
+		f->size == sb->st_size &&
+		f->mtime.tv_sec == sb->st_mtim.tv_sec &&
+		f->mtime.tv_nsec == sb->st_mtim.tv_nsec;
+}
+
+
+static void load_index(const char *index)
+{
+	char buf[4096 + 128];
+	struct indexed_file *f = NULL;
+	FILE *in = fopen(index, "re");
+
+	if (in == NULL)
+		return;
+
+	if (fgets(buf, sizeof(buf), in) == NULL ||
+	    strcmp(buf, INDEX_HEADER)) {
+		fclose(in);
+		return;
+	}
+
+	while (fgets(buf, sizeof(buf), in)) {
+		unsigned long long dev, ino;
+		long long size, sec;
+		long nsec;
+		char path[4097];
+
+		buf[strcspn(buf, "\n")] = 0;
+		if (buf[0] == 'F' && sscanf(buf, "F %llu %llu %lld %lld.%ld "
+				"%4096s", &dev, &ino, &size, &sec, &nsec,
+				path) == 6) {
+			f = add_file(path);
+			if (f == NULL)
+				break;
+			f->dev = dev;
+			f->ino = ino;
+			f->size = size;
+			f->mtime.tv_sec = sec;
+			f->mtime.tv_nsec = nsec;
+		} else if (buf[0] == 'D' && buf[1] == ' ' && f) {
+			if (add_dir(f, buf + 2, strlen(buf + 2)))
+				break;
+		}
+	}
+	fclose(in);
+}
+
+
+static void save_index(const char *index)
+{
+	char tmp[4096];
+	size_t i, j;
+	FILE *out;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", index) >=
+							(int)sizeof(tmp))
+		return;
+	fd = mkostemp(tmp, O_CLOEXEC);
+	if (fd < 0)
+		return;
+	out = fdopen(fd, "w");
+	if (out == NULL) {
+		close(fd);
+		unlink(tmp);
+		return;
+	}
+
+	fputs(INDEX_HEADER, out);
+	for (i = 0; i < nfiles; i++) {
+		const struct indexed_file *f = &files[i];
+
+		fprintf(out, "F %llu %llu %lld %lld.%09ld %s\n",
+			(unsigned long long)f->dev,
+			(unsigned long long)f->ino, (long long)f->size,
+			(long long)f->mtime.tv_sec, f->mtime.tv_nsec, f->path);
+		for (j = 0; j < f->ndirs; j++)
+			fprintf(out, "D %s\n", f->dirs[j]);
+	}
+
+	if (fflush(out) || fsync(fd) || ferror(out) || rename(tmp, index)) {
+		msg(LOG_WARNING, "Cannot save %s", index);
+		unlink(tmp);
+	} else
+		dirty = 0;
+	fclose(out);
+}
+
+
+static void check_file(const char *path)
+{
+	struct indexed_file *f = find_file(path);
+	struct stat sb;
+
+	if (stat(path, &sb) || !S_ISREG(sb.st_mode))
+		return;
+
+	if (f == NULL) {
+		f = add_file(path);
+		if (f == NULL)
+			return;
+	} else if (same_stamp(f, &sb)) {
+		f->seen = 1;
+		return;
+	}
+
+	// If it can't be read, it has to be checked every time
+	if (scan_file(f, &sb))
+		add_dir(f, "/", 1);
+	f->seen = 1;
+}
+
+
+static int ftw_check_file(const char *fpath,
+		const struct stat *sb __attribute__ ((unused)),
+		int typeflag,
+		struct FTW *ftwbuf __attribute__ ((unused)))
+{
+	if (typeflag == FTW_F)
+		check_file(fpath);
+	return FTW_CONTINUE;
+}
+
+
+// fapolicyd.trust first, then trust.d sorted by path
+static int file_cmp(const void *a, const void *b)
+{
+	const struct indexed_file *fa = a, *fb = b;
+
+	if (strcmp(fa->path, TRUST_FILE_PATH) == 0)
+		return -1;
+	if (strcmp(fb->path, TRUST_FILE_PATH) == 0)
+		return 1;
+	return strcmp(fa->path, fb->path);
+}
+
+
+// Returns 1 if f could hold an entry that starts with path
+static int may_hold(const struct indexed_file *f, const char *path)
+{
+	size_t i, len = strlen(path);
+
+	for (i = 0; i < f->ndirs; i++) {
+		size_t dlen = strlen(f->dirs[i]);
+
+		if (strncmp(f->dirs[i], path, dlen < len ? dlen : len) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+
+/*
+ * Bring the index up to date and return the trust files that may have
+ * entries starting with path. The caller frees each string and the
+ * array. It returns 0 on success and 1 on error.
+ */
+int trust_index_files(const char *index, const char *path,
+		char ***out, size_t *n)
+{
+	size_t i;
+
+	if (!loaded) {
+		load_index(index);
+		loaded = 1;
+	}
+
+	for (i = 0; i < nfiles; i++)
+		files[i].seen = 0;
+	check_file(TRUST_FILE_PATH);
+	nftw(TRUST_DIR_PATH, &ftw_check_file, FTW_NOPENFD, FTW_FLAGS);
+
+	// Forget trust files that are gone
+	for (i = 0; i < nfiles; ) {
+		if (files[i].seen)
+			i++;
+		else
+			remove_file(i);
+	}
+	if (nfiles > 1)
+		qsort(files, nfiles, sizeof(*files), file_cmp);
+
+	*out = malloc((nfiles ? nfiles : 1) * sizeof(char *));
+	if (*out == NULL)
+		return 1;
+	*n = 0;
+	for (i = 0; i < nfiles; i++) {
+		if (!may_hold(&files[i], path))
+			continue;
+		(*out)[*n] = strdup(files[i].path);
+		if ((*out)[*n] == NULL) {
+			while (*n)
+				free((*out)[--*n]);
+			free(*out);
+			return 1;
+		}
+		(*n)++;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Call after rewriting a trust file. Entries were only removed or
+ * changed, so the directories are still a superset. Only the stamp is
+ * updated.
+ */
+void trust_index_touch(const char *file)
+{
+	struct indexed_file *f = find_file(file);
+	struct stat sb;
+
+	if (f == NULL)
+		return;
+	if (stat(file, &sb)) {
+		remove_file(f - files);
+		return;
+	}
+	f->dev = sb.st_dev;
+	f->ino = sb.st_ino;
+	f->size = sb.st_size;
+	f->mtime = sb.st_mtim;
+	dirty = 1;
+}
+
+
+// Save the index if it changed and free it
+void trust_index_close(const char *index)
+{
+	size_t i;
+
+	if (dirty)
+		save_index(index);
+
+	for (i = 0; i < nfiles; i++) {
+		free_dirs(&files[i]);
+		free(files[i].path);
+	}
+	free(files);
+	files = NULL;
+	nfiles = files_size = 0;
+	loaded = dirty = 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * trust-index.h - Header file for the trust file index
+ * Copyright (c) 2021 Red Hat Inc.
+ * All Rights Reserved.
+ *
+ * This software may be freely redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; see the file COPYING. If not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef TRUST_INDEX_H
+#define TRUST_INDEX_H
+
+#include <stddef.h>
+
+#define TRUST_INDEX_PATH "/var/lib/fapolicyd/trust-file.index"
+
+int trust_index_files(const char *index, const char *path,
+		char ***files, size_t *n);
+void trust_index_touch(const char *file);
+void trust_index_close(const char *index);
+
+#endif
@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string.h>
+#include <error.h>
+#include "bloom.h"
+
+#define KEYS 10000
+
+int main(void)
+{
+	bloom_t b;
+	char key[64];
+	int i, fp = 0;
+
+	bloom_init(&b);
+
+	// An empty filter can't rule anything out
+	if (!bloom_check(&b, "/usr/bin/ls", 11))
+		error(1, 0, "Unallocated filter rejected a key");
+
+	if (bloom_create(&b, KEYS))
+		error(1, 0, "Cannot create filter");
+
+	for (i = 0; i < KEYS; i++) {
+		snprintf(key, sizeof(key), "/usr/lib64/lib%d.so", i);
+		bloom_add(&b, key, strlen(key));
+	}
+	if (b.items != KEYS)
+		error(1, 0, "Filter counted %lu keys", b.items);
+
+	// There must never be a false negative
+	for (i = 0; i < KEYS; i++) {
+		snprintf(key, sizeof(key), "/usr/lib64/lib%d.so", i);
+		if (!bloom_check(&b, key, strlen(key)))
+			error(1, 0, "False negative for %s", key);
+	}
+
+	// False positives should be rare
+	for (i = 0; i < KEYS; i++) {
+		snprintf(key, sizeof(key), "/home/user/lib%d.so", i);
+		fp += bloom_check(&b, key, strlen(key));
+	}
+	if (fp > KEYS / 50)
+		error(1, 0, "Too many false positives: %d", fp);
+	if (bloom_fp_rate(&b) > 0.02)
+		error(1, 0, "Expected false positive rate is too high");
+
+	bloom_reset(&b);
+	snprintf(key, sizeof(key), "/usr/lib64/lib%d.so", 0);
+	if (bloom_check(&b, key, strlen(key)) || b.items)
+		error(1, 0, "Reset did not clear the filter");
+
+	bloom_destroy(&b);
+	return 0;
+}
@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <string.h>
+#include <error.h>
+#include "intern.h"
+
+#define STRINGS 5000
+
+int main(void)
+{
+	const char *strs[STRINGS], *a, *b;
+	char buf[32], copy[32];
+	int i;
+
+	// Equal text gives the same pointer
+	strcpy(copy, "application/x-sharedlib");
+	a = intern("application/x-sharedlib");
+	b = intern(copy);
+	if (a == NULL || a != b)
+		error(1, 0, "Equal strings were not shared");
+	if (strcmp(a, copy))
+		error(1, 0, "Interned string is %s", a);
+	if (intern_find(copy) != a)
+		error(1, 0, "Cannot find an interned string");
+	if (intern_find("text/plain"))
+		error(1, 0, "Found a string nobody interned");
+
+	// The string lives until the last user is gone
+	intern_release(b);
+	if (intern_find(copy) != a)
+		error(1, 0, "String was freed while still in use");
+	b = intern_ref(a);
+	intern_release(a);
+	intern_release(b);
+	if (intern_find(copy))
+		error(1, 0, "Unused string is still there");
+
+	// The table grows and keeps every string apart
+	for (i = 0; i < STRINGS; i++) {
+		snprintf(buf, sizeof(buf), "/usr/lib64/lib%d.so", i);
+		strs[i] = intern(buf);
+		if (strs[i] == NULL)
+			error(1, 0, "Cannot intern %s", buf);
+	}
+	for (i = 0; i < STRINGS; i++) {
+		snprintf(buf, sizeof(buf), "/usr/lib64/lib%d.so", i);
+		if (intern_find(buf) != strs[i])
+			error(1, 0, "Lost %s after growing", buf);
+	}
+	for (i = 0; i < STRINGS; i += 2)
+		intern_release(strs[i]);
+	for (i = 0; i < STRINGS; i++) {
+		snprintf(buf, sizeof(buf), "/usr/lib64/lib%d.so", i);
+		if ((intern_find(buf) != NULL) != (i % 2))
+			error(1, 0, "Release of %s went wrong", buf);
+	}
+	for (i = 1; i < STRINGS; i += 2)
+		intern_release(strs[i]);
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <error.h>
+#include "lru.h"
+
+#define THREADS 8
+#define ROUNDS 50000
+#define SLOTS 256
+#define IDS 1024
+#define POISON 0xdeadbeefU
+
+struct item {
+	unsigned int id;
+};
+
+static atomic_ulong created, released;
+
+static void cleanup(void *item)
+{
+	struct item *it = item;
+
+	// Anyone still looking at the item will see the poison
+	it->id = POISON;
+	free(it);
+	atomic_fetch_add(&released, 1);
+}
+
+static int match(const void *item, const void *id)
+{
+	return ((const struct item *)item)->id == *(const unsigned int *)id;
+}
+
+// Few keys so that threads fight over the same sets
+static unsigned int key_of(unsigned int id)
+{
+	return (id % 61) * 2654435761U;
+}
+
+static void *worker(void *arg)
+{
+	Queue *q = arg;
+	unsigned int seed = (unsigned int)(unsigned long)pthread_self();
+	unsigned int i, id;
+
+	for (i = 0; i < ROUNDS; i++) {
+		QNode *n;
+		struct item *it;
+
+		id = rand_r(&seed) % IDS;
+		n = check_lru_cache(q, key_of(id), &id);
+		if (n == NULL)
+			error(1, 0, "Lookup of %u failed", id);
+		if (n->item == NULL) {
+			it = malloc(sizeof(struct item));
+			if (it == NULL)
+				error(1, 0, "Out of memory");
+			it->id = id;
+			atomic_fetch_add(&created, 1);
+			lru_set_item(q, n, it);
+		}
+		it = n->item;
+
+		// Other threads push it out meanwhile, it must stay intact
+		sched_yield();
+		if (it->id != id)
+			error(1, 0, "Item %u changed to %u while in use",
+			      id, it->id);
+
+		switch (rand_r(&seed) % 64) {
+		case 0:
+			lru_evict(q, n);
+			break;
+		case 1:
+			lru_release(q, n);
+			if (i % 128 == 1)
+				lru_flush(q);
+			break;
+		case 2:
+			lru_release(q, n);
+			if (i % 128 == 2)
+				lru_resize(q, SLOTS / 2 + rand_r(&seed) % SLOTS);
+			break;
+		case 3:
+			lru_set_bytes(q, n, sizeof(struct item));
+			lru_release(q, n);
+			if (i % 128 == 3)
+				lru_trim(q, SLOTS * sizeof(struct item) / 4);
+			break;
+		default:
+			lru_release(q, n);
+			break;
+		}
+	}
+	return NULL;
+}
+
+static void stress(cache_policy_t policy)
+{
+	pthread_t threads[THREADS];
+	LStats st;
+	unsigned int i;
+
+	Queue *q = init_lru(SLOTS, policy, cleanup, match, "Stress");
+	if (q == NULL)
+		error(1, 0, "Cannot create cache");
+
+	for (i = 0; i < THREADS; i++)
+		if (pthread_create(&threads[i], NULL, worker, q))
+			error(1, 0, "Cannot create thread");
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	lru_stats(q, &st);
+	if (st.hits + st.misses < (unsigned long)THREADS * ROUNDS)
+		error(1, 0, "%s: %lu lookups counted",
+		      lru_policy_name(policy), st.hits + st.misses);
+	if (q->count > q->total)
+		error(1, 0, "%s: count %u is over %u",
+		      lru_policy_name(policy), q->count, q->total);
+
+	// Nothing is pinned anymore, so every item gets freed
+	destroy_lru(q);
+	if (atomic_load(&created) != atomic_load(&released))
+		error(1, 0, "%s: %lu items created, %lu freed",
+		      lru_policy_name(policy), atomic_load(&created),
+		      atomic_load(&released));
+}
+
+int main(void)
+{
+	stress(POLICY_LRU);
+	stress(POLICY_CLOCK);
+	stress(POLICY_2Q);
+
+	return 0;
+}
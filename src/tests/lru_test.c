@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <error.h>
+#include "lru.h"
+
+#define SLOTS 64
+
+static void cleanup(void *item)
+{
+	free(item);
+}
+
+static int match(const void *item, const void *id)
+{
+	return *(const unsigned int *)item == *(const unsigned int *)id;
+}
+
+static int is_id(void *item, void *id)
+{
+	return match(item, id);
+}
+
+// Look up id under key and fill the entry in on a miss. The entry
+// stays pinned until released.
+static QNode *pin(Queue *q, unsigned int key, unsigned int id, int *hit)
+{
+	QNode *n = check_lru_cache(q, key, &id);
+	unsigned int *item;
+
+	if (n == NULL)
+		error(1, 0, "Lookup of %u failed", id);
+	*hit = n->item != NULL;
+	if (n->item == NULL) {
+		item = malloc(sizeof(unsigned int));
+		if (item == NULL)
+			error(1, 0, "Out of memory");
+		*item = id;
+		lru_set_item(q, n, item);
+	}
+	return n;
+}
+
+static void lookup(Queue *q, unsigned int key, unsigned int id, int *hit)
+{
+	lru_release(q, pin(q, key, id, hit));
+}
+
+static LStats stats(Queue *q)
+{
+	LStats st;
+
+	lru_stats(q, &st);
+	return st;
+}
+
+static Queue *new_cache(cache_policy_t policy)
+{
+	Queue *q = init_lru(SLOTS, policy, cleanup, match, "Test");
+
+	if (q == NULL)
+		error(1, 0, "Cannot create cache");
+	return q;
+}
+
+static void test_lru(void)
+{
+	unsigned int i, ways;
+	QNode *n;
+	int hit;
+
+	Queue *q = new_cache(POLICY_LRU);
+	ways = q->hash->ways;
+
+	// Identities that share a key coexist in the set
+	for (i = 0; i < ways; i++) {
+		lookup(q, 42, i, &hit);
+		if (hit)
+			error(1, 0, "Unexpected hit for %u", i);
+	}
+	for (i = 0; i < ways; i++) {
+		lookup(q, 42, i, &hit);
+		if (!hit)
+			error(1, 0, "Identity %u was pushed out", i);
+	}
+	if (stats(q).collisions)
+		error(1, 0, "%lu collisions with a free way",
+		      stats(q).collisions);
+
+	// A full set gives the least recently used way to a new identity
+	lookup(q, 42, 0, &hit);
+	lookup(q, 42, ways, &hit);
+	if (hit || stats(q).collisions != 1)
+		error(1, 0, "Full set did not collide");
+	lookup(q, 42, 0, &hit);
+	if (!hit)
+		error(1, 0, "Recently used identity was pushed out");
+	lookup(q, 42, 1, &hit);
+	if (hit)
+		error(1, 0, "Least recently used identity was kept");
+
+	// An entry that is not usable is stale
+	n = pin(q, 42, 0, &hit);
+	lru_evict(q, n);
+	lookup(q, 42, 0, &hit);
+	if (hit || stats(q).stale != 1)
+		error(1, 0, "Evicted identity was found");
+
+	// A pinned entry pushed out of its set stays usable until released
+	n = pin(q, 42, 0, &hit);
+	for (i = 1; i <= ways; i++)
+		lookup(q, 42, 100 + i, &hit);
+	if (!n->dead || *(unsigned int *)n->item != 0)
+		error(1, 0, "Pinned identity was not kept");
+	lru_release(q, n);
+
+	// A flush empties the cache
+	lru_flush(q);
+	if (q->count)
+		error(1, 0, "%u entries left after flush", q->count);
+	lookup(q, 42, 101, &hit);
+	if (hit)
+		error(1, 0, "Flushed identity was found");
+
+	// Pruning only takes out the items it is asked to
+	lookup(q, 42, 102, &hit);
+	lookup(q, 43, 7, &hit);
+	if (lru_prune(q, is_id, &(unsigned int){ 102 }) != 1)
+		error(1, 0, "Prune missed its item");
+	lookup(q, 43, 7, &hit);
+	if (!hit)
+		error(1, 0, "Prune took out an unrelated item");
+	lookup(q, 42, 102, &hit);
+	if (hit)
+		error(1, 0, "Pruned identity was found");
+	if (q->count > q->total)
+		error(1, 0, "Count %u is over %u", q->count, q->total);
+	destroy_lru(q);
+}
+
+// Items that fit stay when the cache changes size
+static void test_resize(void)
+{
+	unsigned int i;
+	int hit;
+
+	Queue *q = new_cache(POLICY_LRU);
+
+	// A miss on an item just pushed out is a ghost hit
+	for (i = 0; i <= q->hash->ways; i++)
+		lookup(q, 5, i, &hit);
+	lookup(q, 5, 0, &hit);
+	if (hit || stats(q).ghost_hits != 1)
+		error(1, 0, "Ghost was not found");
+
+	for (i = 0; i < SLOTS / 4; i++)
+		lookup(q, i * 2654435761U, 1000 + i, &hit);
+	if (lru_resize(q, SLOTS * 2) || q->total != SLOTS * 2)
+		error(1, 0, "Cannot grow to %u slots", SLOTS * 2);
+	for (i = 0; i < SLOTS / 4; i++) {
+		lookup(q, i * 2654435761U, 1000 + i, &hit);
+		if (!hit)
+			error(1, 0, "Growing lost identity %u", 1000 + i);
+	}
+	if (lru_resize(q, 8) || q->total != 8)
+		error(1, 0, "Cannot shrink to 8 slots");
+	if (q->count > q->total)
+		error(1, 0, "Count %u is over %u", q->count, q->total);
+	destroy_lru(q);
+}
+
+// Trimming drops the oldest entries until their bytes fit the limit
+static void test_trim(void)
+{
+	unsigned int i;
+	int hit;
+
+	Queue *q = new_cache(POLICY_LRU);
+
+	for (i = 0; i < 16; i++) {
+		QNode *n = pin(q, i * 2654435761U, 2000 + i, &hit);
+
+		lru_set_bytes(q, n, 100);
+		lru_release(q, n);
+	}
+	if (lru_bytes(q) != 1600)
+		error(1, 0, "Charged %zu bytes, not 1600", lru_bytes(q));
+
+	// The oldest go first until the rest fits
+	if (lru_trim(q, 1000) != 6 || lru_bytes(q) != 1000 || q->count != 10)
+		error(1, 0, "Trim left %zu bytes in %u entries",
+		      lru_bytes(q), q->count);
+	lookup(q, 0, 2000, &hit);
+	if (hit)
+		error(1, 0, "Trim kept the oldest entry");
+	lookup(q, 15 * 2654435761U, 2015, &hit);
+	if (!hit)
+		error(1, 0, "Trim dropped the newest entry");
+	destroy_lru(q);
+}
+
+// Referenced ways get a second chance
+static void test_clock(void)
+{
+	unsigned int i, ways;
+	int hit;
+
+	Queue *q = new_cache(POLICY_CLOCK);
+	ways = q->hash->ways;
+
+	for (i = 0; i < ways; i++)
+		lookup(q, 7, i, &hit);
+	for (i = 0; i + 1 < ways; i++)
+		lookup(q, 7, i, &hit);
+	lookup(q, 7, ways, &hit);
+	for (i = 0; i + 1 < ways; i++) {
+		lookup(q, 7, i, &hit);
+		if (!hit)
+			error(1, 0, "Referenced identity %u was pushed out", i);
+	}
+	lookup(q, 7, ways - 1, &hit);
+	if (hit)
+		error(1, 0, "Unreferenced identity was kept");
+	destroy_lru(q);
+}
+
+// A scan of identities used once doesn't push out hot ones
+static void test_2q(void)
+{
+	unsigned int i, hot;
+	int hit;
+
+	Queue *q = new_cache(POLICY_2Q);
+	hot = q->hash->ways / 2;
+
+	for (i = 0; i < hot; i++) {
+		lookup(q, 9, i, &hit);
+		lookup(q, 9, i, &hit);
+	}
+	if (stats(q).promotions != hot)
+		error(1, 0, "%lu promotions for %u hits",
+		      stats(q).promotions, hot);
+	for (i = 1000; i < 2000; i++)
+		lookup(q, 9, i, &hit);
+	for (i = 0; i < hot; i++) {
+		lookup(q, 9, i, &hit);
+		if (!hit)
+			error(1, 0, "Scan pushed out hot identity %u", i);
+	}
+	if (stats(q).protected_hits != hot)
+		error(1, 0, "%lu protected hits", stats(q).protected_hits);
+
+	// Shrinking keeps the protected ones over newer items
+	for (i = 0; i < SLOTS / 4; i++)
+		lookup(q, i * 2654435761U, 3000 + i, &hit);
+	if (lru_resize(q, q->hash->ways))
+		error(1, 0, "Cannot shrink to one set");
+	for (i = 0; i < hot; i++) {
+		lookup(q, 9, i, &hit);
+		if (!hit)
+			error(1, 0, "Shrink pushed out hot identity %u", i);
+	}
+	if (stats(q).protected_hits != 2 * hot)
+		error(1, 0, "Shrink lost the protection of hot identities");
+	destroy_lru(q);
+}
+
+int main(void)
+{
+	struct timespec t = { 1000, 500 };
+
+	test_lru();
+	test_resize();
+	test_trim();
+	test_clock();
+	test_2q();
+
+	// Keys differ in every part of the identity
+	if (compute_subject_key(100, &t) == compute_subject_key(101, &t))
+		error(1, 0, "Subject key ignores the pid");
+	if (compute_object_key(1, 2, &t, 3) == compute_object_key(1, 2, &t, 4))
+		error(1, 0, "Object key ignores the size");
+
+	return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * path_filter_bench.c - compare the rpm path filters
+ *
+ * Reads a file list, one path per line, and times the fnmatch chain
+ * that drop_path used to be against the compiled path filter. Any path
+ * where the two disagree is printed.
+ *
+ * Build with: make -C src/tests path_filter_bench
+ * Usage: rpm -qal | path_filter_bench [filter file] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <error.h>
+#include <fnmatch.h>
+#include <stdatomic.h>
+#include "path-filter.h"
+
+// The library needs these
+volatile atomic_bool stop = 0;
+unsigned int debug = 0, permissive = 0;
+
+static path_filter_t filter;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// The way drop_path used to decide
+static int drop_fnmatch(const char *file_name)
+{
+	static const char *share_keep[] = { "*.py?", "*.py", "*/libexec/*",
+		"*.rb", "*.pl", "*.stp", "*.js", "*.jar", "*.m4", "*.php",
+		"*.pm", "*.lua", "*.class", "*.ts", "*.tsx", "*.el", "*.elc",
+		NULL };
+	int i;
+
+	if (file_name[1] == 'u') {
+		if (file_name[5] == 's') {
+			if (file_name[6] == 'h') {
+				for (i = 0; share_keep[i]; i++)
+					if (fnmatch(share_keep[i],
+						    file_name, 0) == 0)
+						return 0;
+				return 1;
+			} else if (file_name[6] == 'r') {
+				if (fnmatch("*/scripts/*", file_name, 0) == 0)
+					return 0;
+				else if (fnmatch("*/tools/objtool/*",
+						 file_name, 0) == 0)
+					return 0;
+				return 1;
+			}
+		} else if (file_name[5] == 'i')
+			return 1;
+	}
+	return 0;
+}
+
+static int drop_compiled(const char *file_name)
+{
+	return path_filter_drop(&filter, file_name);
+}
+
+static void run(const char *name, char **paths, unsigned long count,
+		unsigned int rounds, int (*drop)(const char *))
+{
+	unsigned long i, dropped = 0;
+	unsigned int r;
+	double start, elapsed;
+
+	start = now();
+	for (r = 0; r < rounds; r++)
+		for (i = 0; i < count; i++)
+			dropped += drop(paths[i]);
+	elapsed = now() - start;
+
+	printf("%-10s %12.0f paths/sec, %lu dropped\n", name,
+	       count * rounds / elapsed, dropped / rounds);
+}
+
+int main(int argc, char *argv[])
+{
+	char buf[4096], **paths = NULL;
+	unsigned long count = 0, alloc = 0, i, diff = 0;
+	unsigned int rounds = 10;
+
+	path_filter_init(&filter);
+	if (argc > 1 && strcmp(argv[1], "-")) {
+		if (path_filter_load(&filter, argv[1]))
+			error(1, 0, "Cannot load %s", argv[1]);
+	} else
+		path_filter_load_defaults(&filter);
+	if (argc > 2)
+		rounds = strtoul(argv[2], NULL, 10);
+	if (rounds == 0)
+		rounds = 1;
+
+	while (fgets(buf, sizeof(buf), stdin)) {
+		buf[strcspn(buf, "\n")] = 0;
+		if (buf[0] != '/')
+			continue;
+		if (count == alloc) {
+			alloc = alloc ? alloc * 2 : 4096;
+			paths = realloc(paths, alloc * sizeof(char *));
+			if (paths == NULL)
+				error(1, 0, "Out of memory");
+		}
+		paths[count] = strdup(buf);
+		if (paths[count] == NULL)
+			error(1, 0, "Out of memory");
+		count++;
+	}
+	if (count == 0)
+		error(1, 0, "No paths on stdin");
+
+	for (i = 0; i < count; i++)
+		if (drop_fnmatch(paths[i]) != drop_compiled(paths[i])) {
+			printf("differ: %s (fnmatch %s, compiled %s)\n",
+			       paths[i], drop_fnmatch(paths[i]) ? "drop" :
+			       "keep", drop_compiled(paths[i]) ? "drop" :
+			       "keep");
+			diff++;
+		}
+
+	printf("%lu paths, %u rounds, %lu differ\n", count, rounds, diff);
+	run("fnmatch", paths, count, rounds, drop_fnmatch);
+	run("compiled", paths, count, rounds, drop_compiled);
+
+	for (i = 0; i < count; i++)
+		free(paths[i]);
+	free(paths);
+	path_filter_destroy(&filter);
+
+	return 0;
+}
@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <string.h>
+#include <error.h>
+#include <stdatomic.h>
+#include "path-filter.h"
+
+// The library needs these
+volatile atomic_bool stop = 0;
+unsigned int debug = 0, permissive = 0;
+
+static const struct {
+	const char *path;
+	int drop;
+} checks[] = {
+	{ "/usr/bin/ls", 0 },
+	{ "/usr/lib64/libc.so.6", 0 },
+	{ "/usr/share/doc/bash/README", 1 },
+	{ "/usr/share/man/man1/ls.1.gz", 1 },
+	{ "/usr/share/foo/bar.py", 0 },
+	{ "/usr/share/foo/__pycache__/bar.pyc", 0 },
+	{ "/usr/share/foo/bar.pyx", 0 },
+	{ "/usr/share/foo/bar.pyxx", 1 },
+	{ "/usr/share/foo/libexec/helper", 0 },
+	{ "/usr/share/emacs/site-lisp/foo.elc", 0 },
+	{ "/usr/share/app/main.tsx", 0 },
+	{ "/usr/share/app/main.tsv", 1 },
+	{ "/usr/share/", 1 },
+	{ "/usr/sharedir/file", 0 },
+	{ "/usr/src/kernels/5.14/Makefile", 1 },
+	{ "/usr/src/kernels/5.14/scripts/sign-file", 0 },
+	{ "/usr/src/kernels/5.14/tools/objtool/objtool", 0 },
+	{ "/usr/include/stdio.h", 1 },
+	{ "/etc/passwd", 0 },
+	{ NULL, 0 }
+};
+
+static const char *bad[] = {
+	"keep",
+	"skip /usr/share/",
+	"drop usr/share/",
+	"keep /nowhere/ *.py",		// no prefix line
+	"drop /usr/share/ *.py",	// same action as the prefix
+	"keep /usr/share/ .py",		// not a pattern
+	"keep /usr/share/ *a*b*",
+	"keep /usr/share/ *.py extra",
+	NULL
+};
+
+int main(void)
+{
+	path_filter_t f;
+	int i;
+
+	path_filter_init(&f);
+	path_filter_load_defaults(&f);
+	if (f.rules == 0)
+		error(1, 0, "No built-in rules");
+
+	for (i = 0; checks[i].path; i++)
+		if (path_filter_drop(&f, checks[i].path) != checks[i].drop)
+			error(1, 0, "%s should be %s", checks[i].path,
+			      checks[i].drop ? "dropped" : "kept");
+
+	if (path_filter_add(&f, "# comment") || path_filter_add(&f, "  "))
+		error(1, 0, "Comments and blank lines should be ignored");
+	for (i = 0; bad[i]; i++)
+		if (path_filter_add(&f, bad[i]) == 0)
+			error(1, 0, "Accepted bad rule: %s", bad[i]);
+
+	// A longer prefix overrides a shorter one
+	if (path_filter_add(&f, "keep /usr/share/licenses/"))
+		error(1, 0, "Cannot add a nested prefix");
+	if (path_filter_drop(&f, "/usr/share/licenses/bash/COPYING"))
+		error(1, 0, "Nested prefix did not override its parent");
+
+	path_filter_destroy(&f);
+	if (path_filter_drop(&f, "/usr/include/stdio.h"))
+		error(1, 0, "An empty filter should keep everything");
+
+	return 0;
+}
@@ -0,0 +1,37 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <error.h>
+#include "slab.h"
+
+#define OBJS 1000
+
+int main(void)
+{
+	slab_t s;
+	void *objs[OBJS];
+	int i;
+
+	slab_init(&s, 40, 16);
+	for (i = 0; i < OBJS; i++) {
+		objs[i] = slab_alloc(&s);
+		if (objs[i] == NULL)
+			error(1, 0, "Cannot allocate object %d", i);
+		if ((uintptr_t)objs[i] % sizeof(void *))
+			error(1, 0, "Object %d is not aligned", i);
+		memset(objs[i], i, 40);
+	}
+	if (s.in_use != OBJS)
+		error(1, 0, "Slab counted %lu objects", s.in_use);
+	for (i = 0; i < OBJS; i++)
+		if (((unsigned char *)objs[i])[39] != (unsigned char)i)
+			error(1, 0, "Object %d was overwritten", i);
+
+	// A freed object is handed out again
+	slab_free(&s, objs[7]);
+	if (slab_alloc(&s) != objs[7])
+		error(1, 0, "Freed object was not reused");
+	slab_destroy(&s);
+
+	return 0;
+}
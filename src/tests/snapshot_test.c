@@ -0,0 +1,41 @@
+#include <stdio.h>
+#include <stdatomic.h>
+#include <error.h>
+#include "event.h"
+
+// The library expects these from the daemon
+volatile atomic_bool stop = 0;
+unsigned int debug = 0, permissive = 0;
+
+#define STAMPS "fapolicyd 1.0.4\nrpmdb 1700000000.000000000 4096\n"
+
+int main(void)
+{
+	integrity_t saved, loaded;
+
+	// Without stamps the trust of a snapshot is never used
+	if (snapshot_digest(NULL, IN_NONE))
+		error(1, 0, "Digest without stamps is not 0");
+
+	for (saved = IN_NONE; saved <= IN_SHA256; saved++) {
+		unsigned long long d = snapshot_digest(STAMPS, saved);
+
+		if (d == 0 || d != snapshot_digest(STAMPS, saved))
+			error(1, 0, "Digest for integrity %u is unstable",
+			      saved);
+
+		// Changing the integrity between save and load drops trust
+		for (loaded = IN_NONE; loaded <= IN_SHA256; loaded++)
+			if (loaded != saved &&
+			    d == snapshot_digest(STAMPS, loaded))
+				error(1, 0, "Integrity %u trust is used "
+				      "with integrity %u", saved, loaded);
+	}
+
+	// Other stamps mean another database
+	if (snapshot_digest(STAMPS, IN_SHA256) ==
+	    snapshot_digest("fapolicyd 1.0.4\n", IN_SHA256))
+		error(1, 0, "Digest ignores the stamps");
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * trust_db_bench.c - compare trust database lookup strategies
+ *
+ * Builds a scratch lmdb database shaped like the trust database and
+ * times lookups that copy and sscanf each record against lookups that
+ * parse the record in place.
+ *
+ * Build with: make -C src/tests trust_db_bench
+ * Usage: trust_db_bench [entries] [lookups]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <error.h>
+#include <stdatomic.h>
+#include <lmdb.h>
+#include "database.h"
+#include "fapolicyd-backend.h"
+
+#define SHA "61a9960bf7d255a85811f4afcac51067b8f2e4c75e21cf4f2af95319d4ed1b87"
+
+// The library needs these
+volatile atomic_bool stop = 0;
+unsigned int debug = 0, permissive = 0;
+
+static MDB_env *env;
+static MDB_dbi dbi;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void make_key(char *buf, size_t len, unsigned long i)
+{
+	snprintf(buf, len, "/usr/lib64/bench/dir%lu/libbench%lu.so.1",
+		 i % 97, i);
+}
+
+static void populate(unsigned long entries)
+{
+	MDB_txn *txn;
+	unsigned long i;
+
+	if (mdb_txn_begin(env, NULL, 0, &txn))
+		error(1, 0, "Cannot begin write txn");
+	if (mdb_dbi_open(txn, "trust.db", MDB_CREATE|MDB_DUPSORT, &dbi))
+		error(1, 0, "Cannot open dbi");
+
+	for (i = 0; i < entries; i++) {
+		char path[128], data[128];
+		MDB_val key, val;
+
+		make_key(path, sizeof(path), i);
+		snprintf(data, sizeof(data), DATA_FORMAT, SRC_RPM, i, SHA);
+		key.mv_data = path;
+		key.mv_size = strlen(path);
+		val.mv_data = data;
+		val.mv_size = strlen(data);
+		if (mdb_put(txn, dbi, &key, &val, 0))
+			error(1, 0, "Cannot write entry %lu", i);
+	}
+	if (mdb_txn_commit(txn))
+		error(1, 0, "Cannot commit");
+}
+
+// The way lookups used to be done: copy the record, then sscanf it
+static int lookup_copy(MDB_cursor *c, const char *path, off_t want)
+{
+	MDB_val key, val;
+	unsigned int tsource;
+	off_t size;
+	char sha[65], *data;
+	int res = 0;
+
+	key.mv_data = (void *)path;
+	key.mv_size = strlen(path);
+	if (mdb_cursor_get(c, &key, &val, MDB_SET))
+		return 0;
+
+	data = malloc(val.mv_size + 1);
+	if (data == NULL)
+		return 0;
+	memcpy(data, val.mv_data, val.mv_size);
+	data[val.mv_size] = 0;
+	if (sscanf(data, DATA_FORMAT, &tsource, &size, sha) == 3)
+		res = size == want && strcmp(sha, SHA) == 0;
+	free(data);
+
+	return res;
+}
+
+// The way lookups are done now: parse the record in the memory map
+static int lookup_in_place(MDB_cursor *c, const char *path, off_t want)
+{
+	MDB_val key, val;
+	unsigned int tsource;
+	off_t size;
+	const char *sha;
+	size_t sha_len;
+
+	key.mv_data = (void *)path;
+	key.mv_size = strlen(path);
+	if (mdb_cursor_get(c, &key, &val, MDB_SET))
+		return 0;
+
+	if (parse_trust_data(val.mv_data, val.mv_size, &tsource, &size,
+				&sha, &sha_len))
+		return 0;
+
+	return size == want && sha_len == 64 && memcmp(sha, SHA, 64) == 0;
+}
+
+static void run(const char *name, unsigned long entries,
+		unsigned long lookups,
+		int (*lookup)(MDB_cursor *, const char *, off_t))
+{
+	MDB_txn *txn;
+	MDB_cursor *c;
+	unsigned long i, found = 0;
+	double start, elapsed;
+
+	if (mdb_txn_begin(env, NULL, MDB_RDONLY, &txn))
+		error(1, 0, "Cannot begin read txn");
+	if (mdb_cursor_open(txn, dbi, &c))
+		error(1, 0, "Cannot open cursor");
+
+	start = now();
+	for (i = 0; i < lookups; i++) {
+		char path[128];
+		unsigned long n = (i * 7919) % entries;
+
+		make_key(path, sizeof(path), n);
+		found += lookup(c, path, n);
+	}
+	elapsed = now() - start;
+
+	mdb_cursor_close(c);
+	mdb_txn_abort(txn);
+
+	if (found != lookups)
+		error(1, 0, "%s: only %lu of %lu lookups matched", name,
+		      found, lookups);
+	printf("%-10s %10.0f lookups/sec\n", name, lookups / elapsed);
+}
+
+int main(int argc, char *argv[])
+{
+	char dir[] = "/tmp/trust_db_bench.XXXXXX", path[64];
+	unsigned long entries = 200000, lookups = 2000000;
+
+	if (argc > 1)
+		entries = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		lookups = strtoul(argv[2], NULL, 10);
+	if (entries == 0)
+		error(1, 0, "Need at least 1 entry");
+
+	if (mkdtemp(dir) == NULL)
+		error(1, 0, "Cannot make a scratch directory");
+
+	if (mdb_env_create(&env))
+		error(1, 0, "Cannot create env");
+	mdb_env_set_maxdbs(env, 2);
+	mdb_env_set_mapsize(env, 512UL*1024*1024);
+	if (mdb_env_open(env, dir, MDB_NOSYNC, 0600))
+		error(1, 0, "Cannot open env");
+
+	populate(entries);
+	printf("%lu entries, %lu lookups\n", entries, lookups);
+	run("copy", entries, lookups, lookup_copy);
+	run("in-place", entries, lookups, lookup_in_place);
+
+	mdb_env_close(env);
+	snprintf(path, sizeof(path), "%s/data.mdb", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/lock.mdb", dir);
+	unlink(path);
+	rmdir(dir);
+
+	return 0;
+}
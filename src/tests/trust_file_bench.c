@@ -0,0 +1,140 @@
+/*
+ * trust_file_bench.c - time loading large trust files
+ *
+ * Writes a synthetic trust file and times trust_file_load against the
+ * old fgets, sscanf and list_contains loader. The old loader is quadratic
+ * in the number of entries, so it only runs on the first entries.
+ *
+ * Build with: make -C src/tests trust_file_bench
+ * Usage: trust_file_bench [entries] [old loader entries]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include <error.h>
+#include <stdatomic.h>
+#include "fapolicyd-backend.h"
+#include "llist.h"
+#include "trust-file.h"
+
+#define SHA "61a9960bf7d255a85811f4afcac51067b8f2e4c75e21cf4f2af95319d4ed1b87"
+
+// The library needs these
+volatile atomic_bool stop = 0;
+unsigned int debug = 0, permissive = 0;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Every 1000th entry repeats an earlier path
+static void make_file(const char *path, unsigned long entries)
+{
+	FILE *f = fopen(path, "w");
+	unsigned long i, n;
+
+	if (f == NULL)
+		error(1, 0, "Cannot create %s", path);
+	fprintf(f, "# synthetic trust file\n");
+	for (i = 0; i < entries; i++) {
+		n = i % 1000 == 999 ? i - 500 : i;
+		fprintf(f, "/opt/bench/dir%lu/file%lu %lu %s\n", n % 101, n,
+			i, SHA);
+	}
+	fclose(f);
+}
+
+// The way trust files used to be loaded
+static int old_load(const char *fpath, list_t *list)
+{
+	FILE *file = fopen(fpath, "r");
+	char buffer[4096+1+1+1+10+1+64+1];
+
+	if (!file)
+		return 1;
+
+	while (fgets(buffer, sizeof(buffer), file)) {
+		char name[4097], sha[65], *index, *data;
+		unsigned long sz;
+
+		if (iscntrl(buffer[0]) || buffer[0] == '#')
+			continue;
+		if (sscanf(buffer, "%4096s %lu %64s", name, &sz, sha) != 3) {
+			fclose(file);
+			return 2;
+		}
+		if (asprintf(&data, DATA_FORMAT, SRC_FILE_DB, sz, sha) == -1)
+			data = NULL;
+		index = strdup(name);
+		if (!index || !data || list_contains(list, index)) {
+			free(index);
+			free(data);
+			continue;
+		}
+		if (list_append(list, index, data)) {
+			free(index);
+			free(data);
+		}
+	}
+	fclose(file);
+	return 0;
+}
+
+static long run(const char *name, const char *path, unsigned long entries,
+		int (*load)(const char *, list_t *))
+{
+	list_t list;
+	double start, elapsed;
+	long count;
+
+	list_init(&list);
+	start = now();
+	if (load(path, &list))
+		error(1, 0, "%s: cannot load %s", name, path);
+	elapsed = now() - start;
+	count = list.count;
+	list_empty(&list);
+
+	printf("%-8s %8lu entries %10.0f entries/sec, %ld kept\n", name,
+	       entries, entries / elapsed, count);
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	char path[] = "/tmp/trust_file_bench.XXXXXX";
+	unsigned long entries = 500000, old_entries = 20000;
+	int fd;
+
+	if (argc > 1)
+		entries = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		old_entries = strtoul(argv[2], NULL, 10);
+	if (old_entries > entries)
+		old_entries = entries;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		error(1, 0, "Cannot make a scratch file");
+	close(fd);
+
+	if (old_entries) {
+		make_file(path, old_entries);
+		if (run("old", path, old_entries, old_load) !=
+		    run("mmap", path, old_entries, trust_file_load))
+			error(1, 0, "The loaders disagree");
+	}
+	make_file(path, entries);
+	run("mmap", path, entries, trust_file_load);
+
+	unlink(path);
+	return 0;
+}
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <string.h>
+#include <error.h>
+#include <stdatomic.h>
+#include "database.h"
+
+// The library needs these
+volatile atomic_bool stop = 0;
+unsigned int debug = 0, permissive = 0;
+
+#define ALL_ALIASES (USR_ALIAS_LIB|USR_ALIAS_LIB64|USR_ALIAS_BIN|USR_ALIAS_SBIN)
+
+static void check(const char *path, unsigned int aliases, const char *want)
+{
+	char buf[64];
+	size_t len = canonical_trust_path(path, aliases, buf, sizeof(buf));
+
+	if (want == NULL) {
+		if (len)
+			error(1, 0, "%s should not be rewritten, got %s",
+			      path, buf);
+		return;
+	}
+	if (len != strlen(want) || strcmp(buf, want))
+		error(1, 0, "%s should be %s, got %s", path, want,
+		      len ? buf : "nothing");
+}
+
+int main(void)
+{
+	// Each alias rewrites its own directory
+	check("/bin/ls", ALL_ALIASES, "/usr/bin/ls");
+	check("/sbin/init", ALL_ALIASES, "/usr/sbin/init");
+	check("/lib/libc.so.6", ALL_ALIASES, "/usr/lib/libc.so.6");
+	check("/lib64/libc.so.6", ALL_ALIASES, "/usr/lib64/libc.so.6");
+
+	// Only active aliases apply
+	check("/bin/ls", USR_ALIAS_LIB|USR_ALIAS_LIB64, NULL);
+	check("/lib64/libc.so.6", USR_ALIAS_LIB, NULL);
+	check("/lib/libc.so.6", USR_ALIAS_LIB64, NULL);
+	check("/bin/ls", 0, NULL);
+
+	// Canonical paths and look-alikes are left alone
+	check("/usr/bin/ls", ALL_ALIASES, NULL);
+	check("/binaries/ls", ALL_ALIASES, NULL);
+	check("/lib", ALL_ALIASES, NULL);
+	check("/opt/bin/ls", ALL_ALIASES, NULL);
+	check("bin/ls", ALL_ALIASES, NULL);
+
+	// Paths that would not fit are not rewritten
+	check("/bin/a-name-that-is-long-enough-to-overflow-the-buffer-it-uses",
+	      ALL_ALIASES, NULL);
+
+	return 0;
+}